@@ -304,7 +304,109 @@ InnerNode* FindChild(ArtNode* backup, unsigned char c) {
   }
 }
 
-InnerNode* FindChild(InnerNode* node, std::string& key, size_t level,
+// Children in Node4 and Node16 are sorted by prefix,
+// Node48 and Node256 are indexed by prefix.
+InnerNode* FindPrevChild(InnerNode* node, unsigned char c) {
+  shared_lock<RWSpinLock> read_lk(node->art_rw_lock_);
+
+  auto art = node->art;
+  if (!art) {
+    return nullptr;
+  }
+
+  switch (art->art_type_) {
+    case kNode4: {
+      auto node4 = (ArtNode4*)art;
+      for (int i = art->num_children_ - 1; i >= 0; --i) {
+        if (node4->keys_[i] < c) {
+          return node4->children_[i];
+        }
+      }
+      return nullptr;
+    }
+    case kNode16: {
+      auto node16 = (ArtNode16*)art;
+      for (int i = art->num_children_ - 1; i >= 0; --i) {
+        if (node16->keys_[i] < c) {
+          return node16->children_[i];
+        }
+      }
+      return nullptr;
+    }
+    case kNode48: {
+      auto node48 = (ArtNode48*)art;
+      for (int i = static_cast<int>(c) - 1; i >= 0; --i) {
+        if (node48->keys_[i]) {
+          return node48->children_[node48->keys_[i] - 1];
+        }
+      }
+      return nullptr;
+    }
+    case kNode256: {
+      auto node256 = (ArtNode256*)art;
+      for (int i = static_cast<int>(c) - 1; i >= 0; --i) {
+        if (node256->children_[i]) {
+          return node256->children_[i];
+        }
+      }
+      return nullptr;
+    }
+    default:
+      return nullptr;
+  }
+}
+
+InnerNode* FindNextChild(InnerNode* node, unsigned char c) {
+  shared_lock<RWSpinLock> read_lk(node->art_rw_lock_);
+
+  auto art = node->art;
+  if (!art) {
+    return nullptr;
+  }
+
+  switch (art->art_type_) {
+    case kNode4: {
+      auto node4 = (ArtNode4*)art;
+      for (int i = 0; i < art->num_children_; ++i) {
+        if (node4->keys_[i] > c) {
+          return node4->children_[i];
+        }
+      }
+      return nullptr;
+    }
+    case kNode16: {
+      auto node16 = (ArtNode16*)art;
+      for (int i = 0; i < art->num_children_; ++i) {
+        if (node16->keys_[i] > c) {
+          return node16->children_[i];
+        }
+      }
+      return nullptr;
+    }
+    case kNode48: {
+      auto node48 = (ArtNode48*)art;
+      for (int i = static_cast<int>(c) + 1; i < 256; ++i) {
+        if (node48->keys_[i]) {
+          return node48->children_[node48->keys_[i] - 1];
+        }
+      }
+      return nullptr;
+    }
+    case kNode256: {
+      auto node256 = (ArtNode256*)art;
+      for (int i = static_cast<int>(c) + 1; i < 256; ++i) {
+        if (node256->children_[i]) {
+          return node256->children_[i];
+        }
+      }
+      return nullptr;
+    }
+    default:
+      return nullptr;
+  }
+}
+
+InnerNode* FindChild(InnerNode* node, const Slice& key, size_t level,
                      InnerNode** backup, size_t& backup_level) {
   shared_lock<RWSpinLock> read_lk(node->art_rw_lock_);
 
@@ -529,7 +631,7 @@ void DeleteArtNode(ArtNode* art) {
   delete art;
 }
 
-void DeleteInnerNode(InnerNode* inner_node, uint64_t* inode_vptrs, int count) {
+void DeleteInnerNode(InnerNode* inner_node) {
   if (!inner_node) {
     return;
   }
@@ -549,33 +651,26 @@ void DeleteInnerNode(InnerNode* inner_node, uint64_t* inode_vptrs, int count) {
     return;
   }
 
-  inner_node->nvm_node_->meta.node_info = inner_node->vptr_;
-  FLUSH(inner_node, CACHE_LINE_SIZE);
-
-  if (inner_node->vptr_) {
-    inode_vptrs[count++] = inner_node->vptr_;
-  }
-
   auto art = inner_node->art;
   if (art->art_type_ == kNode4) {
     auto art4 = (ArtNode4*)art;
     for (int i = 0; i < art->num_children_; ++i) {
-      DeleteInnerNode(art4->children_[i], inode_vptrs, count);
+      DeleteInnerNode(art4->children_[i]);
     }
   } else if (art->art_type_ == kNode16) {
     auto art16 = (ArtNode16*)art;
     for (int i = 0; i < art->num_children_; ++i) {
-      DeleteInnerNode(art16->children_[i], inode_vptrs, count);
+      DeleteInnerNode(art16->children_[i]);
     }
   } else if (art->art_type_ == kNode48) {
     auto art48 = (ArtNode48*)art;
     for (auto& child : art48->children_) {
-      DeleteInnerNode(child, inode_vptrs, count);
+      DeleteInnerNode(child);
     }
   } else {
     auto art256 = (ArtNode256*)art;
     for (auto& child : art256->children_) {
-      DeleteInnerNode(child, inode_vptrs, count);
+      DeleteInnerNode(child);
     }
   }
 
@@ -7,6 +7,7 @@
 #include <vector>
 #include <string>
 #include <rocksdb/rocksdb_namespace.h>
+#include <rocksdb/slice.h>
 
 namespace ROCKSDB_NAMESPACE {
 
@@ -69,16 +70,22 @@ ArtNode* ReallocateArtNode(ArtNode* art);
 
 InnerNode* FindChild(InnerNode* node, unsigned char c);
 
-InnerNode* FindChild(InnerNode* node, std::string& key, size_t level,
+InnerNode* FindChild(InnerNode* node, const Slice& key, size_t level,
                      InnerNode** backup, size_t& backup_level);
 
 InnerNode* FindChild(ArtNode* backup, unsigned char c);
 
+// Return the child with the largest prefix less than c, or nullptr.
+InnerNode* FindPrevChild(InnerNode* node, unsigned char c);
+
+// Return the child with the smallest prefix greater than c, or nullptr.
+InnerNode* FindNextChild(InnerNode* node, unsigned char c);
+
 void InsertToArtNode(
     InnerNode* current, InnerNode* leaf,
     unsigned char c, bool insert_to_group);
 
-void DeleteInnerNode(InnerNode* inner_node, uint64_t* inode_vptrs, int count);
+void DeleteInnerNode(InnerNode* inner_node);
 
 void DeleteArtNode(ArtNode* art);
 
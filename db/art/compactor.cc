@@ -6,8 +6,14 @@
 
 #include <iostream>
 #include <unistd.h>
+#ifdef NUMA
+#include <numa.h>
+#endif
 
 #include <db/db_impl/db_impl.h>
+#include <monitoring/thread_status_util.h>
+#include <util/core_local.h>
+#include <util/threadpool_imp.h>
 
 #include "utils.h"
 #include "logger.h"
@@ -27,13 +33,54 @@ std::atomic<int64_t> SqueezedSize{0};
 std::atomic<int64_t> CompactedSize{0};
 std::atomic<int64_t> SqueezedSizeInCompaction{0};
 std::atomic<int>     BackupRead{0};
-PriorityLock         IteratorLock;
 
+// Pinned epochs are counted per core in a ring of ITERATOR_EPOCH_RING
+// slots. Epoch only advances when the slot it will reuse has drained, so
+// live pins span less than the ring.
+#define ITERATOR_EPOCH_RING 8
+
+// new T[] in CoreLocalArray doesn't honor alignas before C++17, so pins
+// of neighbouring cores are kept a cache line apart by padding instead.
+struct IteratorEpochPins {
+  char padding[CACHE_LINE_SIZE];
+  std::atomic<int64_t> pins[ITERATOR_EPOCH_RING];
+
+  IteratorEpochPins() {
+    for (auto& p : pins) {
+      p.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+std::atomic<uint64_t>   IteratorEpoch{1};
+// Unpinning epochs not newer than this wakes compactor, 0 if no reclaim
+// batch is waiting.
+std::atomic<uint64_t>   WaitingIteratorEpoch{0};
+CoreLocalArray<IteratorEpochPins> PinnedIteratorEpochs;
+TQueueConcurrent<InnerNode*> RetiredInnerNodes;
+
+// Compactor sleeping until total size reaches CompactionTrigger
+std::atomic<Compactor*> ActiveCompactor{nullptr};
+std::atomic<int64_t>    CompactionTrigger{INT64_MAX};
+
+SpinMutex SnapshotsLock;
+std::shared_ptr<const std::vector<SequenceNumber>> LiveSnapshots =
+    std::make_shared<const std::vector<SequenceNumber>>();
 
-ThreadPool* SingleCompactionJob::thread_pool = NewThreadPool(4);
 
 void UpdateTotalSize(int32_t update_size) {
-  MemTotalSize.fetch_add(update_size, std::memory_order_release);
+  auto old_size = MemTotalSize.fetch_add(update_size, std::memory_order_release);
+  auto trigger = CompactionTrigger.load(std::memory_order_relaxed);
+  if (old_size < trigger && old_size + update_size >= trigger) {
+    WakeupCompactor();
+  }
+}
+
+void WakeupCompactor() {
+  auto compactor = ActiveCompactor.load(std::memory_order_acquire);
+  if (compactor) {
+    compactor->Wakeup();
+  }
 }
 
 void UpdateTotalSqueezedSize(int64_t update_size) {
@@ -52,12 +99,101 @@ int64_t GetMemTotalSize() {
   return MemTotalSize.load(std::memory_order_acquire);
 }
 
-void TryCreateIterator() {
-  IteratorLock.LockLowPri();
+uint64_t PinIteratorEpoch() {
+  auto pins = PinnedIteratorEpochs.Access()->pins;
+  while (true) {
+    auto epoch = IteratorEpoch.load();
+    auto& slot = pins[epoch % ITERATOR_EPOCH_RING];
+    slot.fetch_add(1);
+    // Compactor may have advanced epoch and scanned slots in between,
+    // pin is only valid if it's counted before epoch advances.
+    if (likely(IteratorEpoch.load() == epoch)) {
+      return epoch;
+    }
+    slot.fetch_sub(1);
+  }
+}
+
+void UnpinIteratorEpoch(uint64_t epoch) {
+  // Counts of a slot are summed over cores, so unpinning on another core
+  // than the pinning one is fine.
+  PinnedIteratorEpochs.Access()->pins[epoch % ITERATOR_EPOCH_RING]
+      .fetch_sub(1, std::memory_order_release);
+  auto waiting = WaitingIteratorEpoch.load(std::memory_order_acquire);
+  if (waiting && epoch <= waiting) {
+    WakeupCompactor();
+  }
+}
+
+uint64_t GetIteratorEpoch() {
+  return IteratorEpoch.load(std::memory_order_acquire);
+}
+
+// Return true if no iterator pinned at or before epoch is alive.
+// Epochs older than a ring before current one have drained.
+bool IteratorEpochDrained(uint64_t epoch) {
+  auto current = IteratorEpoch.load();
+  uint64_t oldest = current >= ITERATOR_EPOCH_RING
+                        ? current - ITERATOR_EPOCH_RING + 1 : 1;
+  for (auto e = oldest; e <= epoch && e <= current; ++e) {
+    int64_t pins = 0;
+    for (size_t i = 0; i < PinnedIteratorEpochs.Size(); ++i) {
+      pins += PinnedIteratorEpochs.AccessAtCore(i)
+                  ->pins[e % ITERATOR_EPOCH_RING].load();
+    }
+    if (pins > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SetLiveSnapshots(std::vector<SequenceNumber>&& snapshots) {
+  auto new_snapshots =
+      std::make_shared<const std::vector<SequenceNumber>>(std::move(snapshots));
+  std::lock_guard<SpinMutex> snapshots_lk(SnapshotsLock);
+  LiveSnapshots.swap(new_snapshots);
+}
+
+std::shared_ptr<const std::vector<SequenceNumber>> GetLiveSnapshots() {
+  std::lock_guard<SpinMutex> snapshots_lk(SnapshotsLock);
+  return LiveSnapshots;
+}
+
+bool IsPinnedBySnapshot(const std::vector<SequenceNumber>& snapshots,
+                        SequenceNumber seq, SequenceNumber newer_seq) {
+  auto iter = std::lower_bound(snapshots.begin(), snapshots.end(), seq);
+  return iter != snapshots.end() && *iter < newer_seq;
+}
+
+void RetireInnerNode(InnerNode* node) {
+  RetiredInnerNodes.emplace_back(node);
+}
+
+void RetireNVMNode(InnerNode* owner, NVMNode* nvm_node) {
+  // Always retire: an iterator may pin its epoch after this point while
+  // holding a super version taken before the flushed sst was installed.
+  auto retired = new RetiredNVMNode{
+      nvm_node, GetIteratorEpoch(), owner->retired_nvm_nodes_};
+  MEMORY_BARRIER;
+  owner->retired_nvm_nodes_ = retired;
 }
 
-void DeleteIterator() {
-  IteratorLock.UnlockLowPri();
+// Unlink retired nvm nodes no newer than epoch from owner. Iterators
+// may be still walking through them, so they are deleted in next batch.
+void CutRetiredNVMNodes(InnerNode* owner, uint64_t epoch,
+                        std::vector<RetiredNVMNode*>& unlinked) {
+  RetiredNVMNode** link = &owner->retired_nvm_nodes_;
+  while (*link && (*link)->epoch > epoch) {
+    link = &(*link)->next;
+  }
+
+  auto cur = *link;
+  *link = nullptr;
+  while (cur) {
+    unlinked.push_back(cur);
+    cur = cur->next;
+  }
 }
 
 #ifdef ROCKSDB_SUPPORT_THREAD_LOCAL
@@ -65,23 +201,36 @@ thread_local uint8_t fingerprints[224] = {0};
 thread_local uint64_t nvm_data[448] = {0};
 #endif
 
-struct alignas(CACHE_LINE_SIZE) CompactionRec {
-  std::string* key;
-  Slice        value_slice;
-  uint64_t     seq_num;
-  RecordIndex  record_index;
-  KVStruct     s;
-
-  CompactionRec() = default;
-
-  friend bool operator<(const CompactionRec& l, const CompactionRec& r) {
-    return *l.key < *r.key;
+// Read record at vptr, its key is copied into arena of job followed by
+// packed sequence number and type, so it is ready for table builder.
+// Return Corruption if its value can't be uncompressed.
+static Status ReadCompactionRecord(SingleCompactionJob* job, uint64_t vptr,
+                                   CompactionRec& record) {
+  Slice user_key;
+  SequenceNumber seq_num;
+  ValueType type;
+  record.value_slice = Slice();
+  auto s = job->vlog_manager_->GetKeyValue(
+      vptr, user_key, record.value_slice, seq_num, record.record_index,
+      &job->uncompressed_values, type);
+  if (unlikely(!s.ok())) {
+    return s;
   }
-
-  friend bool operator==(const CompactionRec& l, const CompactionRec& r) {
-    return *l.key == *r.key;
+  record.seq_num = (seq_num << 8) | type;
+
+  char* buf = job->arena->Allocate(user_key.size() + kNumInternalBytes);
+  memcpy(buf, user_key.data(), user_key.size());
+  EncodeFixed64(buf + user_key.size(), record.seq_num);
+  record.key = Slice(buf, user_key.size() + kNumInternalBytes);
+
+  char prefix[8] = {0};
+  memcpy(prefix, user_key.data(), std::min(user_key.size(), sizeof(prefix)));
+  record.key_prefix = DecodeFixed64(prefix);
+  if (port::kLittleEndian) {
+    record.key_prefix = __builtin_bswap64(record.key_prefix);
   }
-};
+  return Status::OK();
+}
 
 ////////////////////////////////////////////////////////////
 
@@ -106,7 +255,7 @@ void RewriteData(std::vector<KVStruct>& rewrite_kv, InnerNode* node,
     fingerprints[fpos++] = static_cast<uint8_t>(kv_info.actual_hash);
     nvm_data[pos++] = kv_info.hash;
     nvm_data[pos++] = kv_info.vptr;
-    node->estimated_size_ += kv_info.kv_size;
+    node->estimated_size_ += GetKVSize(kv_info);
 
     bucket = (int)(kv_info.actual_hash & 63);
     h = (int)(kv_info.actual_hash >> 6);
@@ -161,6 +310,7 @@ void RemoveChildren(InnerNode* parent, InnerNode* child) {
       std::lock_guard<RWSpinLock> next_link_lk(after->link_lock_);
 
       next_node->next_node = after;
+      after->prev_node = next_node;
       auto next_nvm_node = GetNodeAllocator()->relative(
           after->backup_nvm_node_
               ? after->backup_nvm_node_ : after->nvm_node_);
@@ -177,6 +327,7 @@ void RemoveChildren(InnerNode* parent, InnerNode* child) {
     {
       std::lock_guard<RWSpinLock> next_link_lk(next_node->link_lock_);
       parent->next_node = next_node;
+      next_node->prev_node = parent;
       auto next_nvm_node =
           GetNodeAllocator()->relative(next_node->backup_nvm_node_
                                            ? next_node->backup_nvm_node_ : next_node->nvm_node_);
@@ -197,7 +348,7 @@ void RemoveChildren(InnerNode* parent, InnerNode* child) {
     }
 
     GetNodeAllocator()->DeallocateNode(support_node->nvm_node_);
-    delete support_node;
+    RetireInnerNode(support_node);
   }
 
   {
@@ -209,16 +360,30 @@ void RemoveChildren(InnerNode* parent, InnerNode* child) {
 
     SET_LEAF(parent);
     SET_ART_NON_FULL(parent);
-    SET_NODE_BUFFER_SIZE(parent->status_, 0);
     memset(parent->buffer_, 0, 256);
     parent->estimated_size_ = 0;
+
+    // Buffer is read from newest to oldest, so older versions kept for
+    // snapshots go before vptr_.
+    uint64_t vptrs[MAX_NODE_VERSIONS + 1];
+    int count = 0;
     if (parent->vptr_) {
-      ++parent->status_;
-      parent->estimated_size_ = parent->vptr_ >> 48;
-      parent->buffer_[0] = parent->hash_;
-      parent->buffer_[1] = parent->vptr_;
+      vptrs[count++] = parent->vptr_;
+      for (auto version = parent->old_versions_; version;
+           version = version->next) {
+        vptrs[count++] = version->vptr;
+      }
     }
+    for (int i = 0; i < count; ++i) {
+      auto vptr = vptrs[count - 1 - i];
+      parent->buffer_[i * 2] = parent->hash_;
+      parent->buffer_[i * 2 + 1] = vptr;
+      parent->estimated_size_ += GetKVSize(KVStruct(parent->hash_, vptr));
+    }
+    SET_NODE_BUFFER_SIZE(parent->status_, count);
+    parent->ClearOldVersions();
     parent->hash_ = parent->vptr_ = 0;
+    PersistNodeVptr(parent, 0);
   }
 }
 
@@ -251,10 +416,45 @@ void ProcessNodes(InnerNode* parent, std::vector<InnerNode*>& children,
 
 int64_t Compactor::compaction_threshold_;
 
+// Threads of pool run at Env::HIGH like flush threads, and are
+// registered to ThreadStatus as high priority threads.
+static ThreadPool* NewCompactionThreadPool(const DBOptions& options) {
+  int num_threads = options.num_compaction_threads > 0
+                        ? options.num_compaction_threads
+                        : std::max(options.num_parallel_compactions, 1);
+  auto thread_pool = new ThreadPoolImpl();
+  thread_pool->SetHostEnv(options.env);
+  thread_pool->SetThreadPriority(Env::Priority::HIGH);
+  thread_pool->SetBackgroundThreads(num_threads);
+
+#ifdef NUMA
+  if (options.compaction_numa_node >= 0 && numa_available() >= 0) {
+    // Each job blocks until all of them are running,
+    // so every thread of pool picks exactly one.
+    std::atomic<int> num_waiting{num_threads};
+    int numa_node = options.compaction_numa_node;
+    thread_pool->SetJobCount(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+      thread_pool->SubmitJob([&num_waiting, numa_node]() {
+        numa_run_on_node(numa_node);
+        num_waiting.fetch_sub(1, std::memory_order_acq_rel);
+        while (num_waiting.load(std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+      });
+    }
+    thread_pool->Join();
+  }
+#endif
+
+  return thread_pool;
+}
+
 Compactor::Compactor(const DBOptions& options)
     : group_manager_(nullptr), vlog_manager_(nullptr),
       num_parallel_compaction_(options.num_parallel_compactions),
-      rewrite_threshold_(options.enable_rewrite ? 1 : INT_MAX) {}
+      rewrite_threshold_(options.enable_rewrite ? 1 : INT_MAX),
+      thread_pool_(NewCompactionThreadPool(options)) {}
 
 Compactor::~Compactor() noexcept {
   printf("Statistics:\n"
@@ -265,10 +465,16 @@ Compactor::~Compactor() noexcept {
       CompactedSize.load(std::memory_order_relaxed),
       SqueezedSize.load(std::memory_order_relaxed));
 
+  Compactor* self = this;
+  ActiveCompactor.compare_exchange_strong(self, nullptr);
+
   for (auto job : compaction_jobs_) {
     delete[] job->compacted_indexes;
     delete job;
   }
+
+  thread_pool_->JoinAllThreads();
+  delete thread_pool_;
 }
 
 void Compactor::SetGroupManager(HeatGroupManager* group_manager) {
@@ -285,7 +491,8 @@ void Compactor::SetVLogManager(VLogManager* vlog_manager) {
 
   for (int i = 0; i < num_parallel_compaction_; ++i) {
     auto job = new SingleCompactionJob;
-    job->keys_in_node = std::vector<std::string>(241);
+    job->read_records.resize(241);
+    job->arena.reset(new Arena(COMPACTION_ARENA_BLOCK_SIZE));
     job->compacted_indexes =
         new autovector<RecordIndex>[vlog_manager_->vlog_segment_num_];
     compaction_jobs_.push_back(job);
@@ -309,17 +516,11 @@ void Compactor::BGWork() {
                                     num_parallel_compaction_ *
                                         HeatGroup::group_min_size_;
 
-  while (true) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  CompactionTrigger.store(choose_threshold, std::memory_order_relaxed);
+  ActiveCompactor.store(this, std::memory_order_release);
 
-    vlog_manager_->FreeQueue();
-    GetNodeAllocator()->FreeNodes();
-    for (auto job : chosen_jobs_) {
-      for (auto art : job->removed_arts) {
-        DeleteArtNode(art);
-      }
-    }
-    chosen_jobs_.clear();
+  while (true) {
+    ReclaimResources();
 
     if (thread_stop_) {
       break;
@@ -327,12 +528,12 @@ void Compactor::BGWork() {
 
     auto cur_mem_size = MemTotalSize.load(std::memory_order_relaxed);
     if (cur_mem_size < choose_threshold) {
-      std::this_thread::yield();
+      // Woken up when total size reaches threshold, segments are reclaimed
+      // by gc or an iterator epoch is drained, timeout is a safety net.
+      WaitForWork(std::chrono::seconds(1));
       continue;
     }
 
-    IteratorLock.LockHighPri();
-
     {
       std::unique_lock<std::mutex> lock{mutex_};
       group_manager_->AddOperation(nullptr, kOperationChooseCompaction, false, this);
@@ -343,6 +544,9 @@ void Compactor::BGWork() {
       }
 
       if (chosen_groups_.empty()) {
+        // Nothing to compact yet, back off instead of spinning
+        lock.unlock();
+        WaitForWork(std::chrono::milliseconds(5));
         continue;
       }
 
@@ -355,29 +559,23 @@ void Compactor::BGWork() {
 
     auto start_time = GetStartTime();
 
-    SingleCompactionJob::thread_pool->SetJobCount(chosen_jobs_.size());
-    for (auto& job : chosen_jobs_) {
-      auto func = std::bind(&Compactor::CompactionPreprocess, this, job);
-      SingleCompactionJob::thread_pool->SubmitJob(func);
+    // Jobs go through all stages independently, a slow group doesn't hold
+    // back the others.
+    thread_pool_->SetJobCount(chosen_jobs_.size());
+    for (auto job : chosen_jobs_) {
+      auto func = std::bind(&Compactor::RunCompactionJob, this, job);
+      thread_pool_->SubmitJob(func);
     }
-    SingleCompactionJob::thread_pool->Join();
-
-    auto preprocess_done_time = GetStartTime();
-    float preprocess_time = (preprocess_done_time - start_time) * 1e-6;
-
-    db_impl_->SyncCallFlush(chosen_jobs_);
-
-    auto flush_done_time = GetStartTime();
-    float flush_time = (flush_done_time - preprocess_done_time) * 1e-6;
+    thread_pool_->Join();
 
     uint64_t total_out_size = 0;
-    SingleCompactionJob::thread_pool->SetJobCount(chosen_jobs_.size());
+    float preprocess_time = 0, flush_time = 0, postprocess_time = 0;
     for (auto job : chosen_jobs_) {
       total_out_size += job->out_file_size;
-      auto func = std::bind(&Compactor::CompactionPostprocess, this, job);
-      SingleCompactionJob::thread_pool->SubmitJob(func);
+      preprocess_time = std::max(preprocess_time, job->preprocess_time);
+      flush_time = std::max(flush_time, job->flush_time);
+      postprocess_time = std::max(postprocess_time, job->postprocess_time);
     }
-    SingleCompactionJob::thread_pool->Join();
 
     for (auto job : chosen_jobs_) {
       for (size_t i = 0; i < all_compacted_indexes_.size(); ++i) {
@@ -390,11 +588,15 @@ void Compactor::BGWork() {
     vlog_manager_->UpdateBitmap(all_compacted_indexes_);
 
     for (auto job : chosen_jobs_) {
-      group_manager_->AddOperation(job->group_, kOperatorMove, true);
+      retired_arts_.insert(retired_arts_.end(), job->removed_arts.begin(),
+                           job->removed_arts.end());
+      retired_owners_.insert(retired_owners_.end(),
+                             job->retired_owners.begin(),
+                             job->retired_owners.end());
     }
+    chosen_jobs_.clear();
 
     auto end_time = GetStartTime();
-    float postprocess_time = (end_time - flush_done_time) * 1e-6;
 
     // Use sfence after all vlog are modified
     NVM_BARRIER;
@@ -430,9 +632,75 @@ void Compactor::BGWork() {
     while (BackupRead.load(std::memory_order_acquire)) {
       std::this_thread::yield();
     }
+  }
+}
 
-    IteratorLock.UnlockHighPri();
+void Compactor::ReclaimResources() {
+  auto allocator = GetNodeAllocator();
+
+  ReclaimBatch batch;
+  batch.num_nvm_nodes = allocator->GetNumWaitingNodes() - pending_nvm_nodes_;
+  batch.num_segments = vlog_manager_->gc_pages_.size() - pending_segments_;
+  auto num_inner_nodes = RetiredInnerNodes.size();
+
+  // Advancing epoch reuses ring slot of the epoch a ring before, so
+  // resources wait for a later round until that epoch has drained.
+  // Waiting epoch is published before pins are checked, so an iterator
+  // unpinned after the check still wakes compactor up.
+  uint64_t waiting = 0;
+  if (batch.num_nvm_nodes || batch.num_segments || num_inner_nodes ||
+      !retired_arts_.empty() || !retired_owners_.empty() ||
+      !unlinked_retired_.empty()) {
+    auto epoch = GetIteratorEpoch();
+    auto reused = epoch >= ITERATOR_EPOCH_RING
+                      ? epoch + 1 - ITERATOR_EPOCH_RING : 0;
+    WaitingIteratorEpoch.store(reused);
+    if (reused && !IteratorEpochDrained(reused)) {
+      waiting = reused;
+    } else {
+      batch.arts.swap(retired_arts_);
+      batch.owners.swap(retired_owners_);
+      batch.retired_nvm_nodes.swap(unlinked_retired_);
+      while (num_inner_nodes--) {
+        batch.inner_nodes.push_back(RetiredInnerNodes.pop_front());
+      }
+
+      // Iterators created from now on can't reach resources in this batch
+      batch.epoch = IteratorEpoch.fetch_add(1);
+      pending_nvm_nodes_ += batch.num_nvm_nodes;
+      pending_segments_ += batch.num_segments;
+      reclaim_batches_.push_back(std::move(batch));
+    }
   }
+
+  while (!reclaim_batches_.empty()) {
+    auto& front = reclaim_batches_.front();
+    WaitingIteratorEpoch.store(std::max(waiting, front.epoch));
+    if (!IteratorEpochDrained(front.epoch)) {
+      return;
+    }
+
+    // Owners must be handled before their arts are deleted
+    for (auto owner : front.owners) {
+      CutRetiredNVMNodes(owner, front.epoch, unlinked_retired_);
+    }
+    for (auto retired : front.retired_nvm_nodes) {
+      delete retired;
+    }
+    allocator->FreeNodes(front.num_nvm_nodes);
+    vlog_manager_->FreeQueue(front.num_segments);
+    for (auto art : front.arts) {
+      DeleteArtNode(art);
+    }
+    for (auto node : front.inner_nodes) {
+      delete node;
+    }
+
+    pending_nvm_nodes_ -= front.num_nvm_nodes;
+    pending_segments_ -= front.num_segments;
+    reclaim_batches_.pop_front();
+  }
+  WaitingIteratorEpoch.store(waiting);
 }
 
 void Compactor::Reset() {
@@ -447,6 +715,8 @@ void Compactor::Reset() {
   thread_local uint64_t nvm_data[448] = {0};
 #endif
 
+  auto snapshots = GetLiveSnapshots();
+
   std::unique_lock<std::mutex> lock{mutex_};
   group_manager_->AddOperation(nullptr, kOperationFlushAll, false, this);
   cond_var_.wait(lock);
@@ -484,17 +754,13 @@ void Compactor::Reset() {
                SIZE_TO_BYTES(GET_NODE_BUFFER_SIZE(node->status_)),
                PMEM_F_MEM_NODRAIN | PMEM_F_MEM_NONTEMPORAL);
 
-        std::vector<CompactionRec> read_records(241);
+        auto& read_records = job->read_records;
 
         auto nvm_node = node->nvm_node_;
         int data_size = GET_SIZE(nvm_node->meta.header);
         auto data = nvm_node->data;
 
         KVStruct tmp_struct{};
-        ValueType type;
-        SequenceNumber seq_num;
-
-        std::vector<std::string>& keys = job->keys_in_node;
 
         size_t count = 0;
         for (int i = -16; i < data_size; ++i) {
@@ -503,26 +769,36 @@ void Compactor::Reset() {
             continue;
           }
 
+          // Corrupted records are dropped instead of being flushed to sst
+          // with valid checksums of their own.
+          if (unlikely(!job->vlog_manager_->VerifyRecord(
+                  tmp_struct.actual_vptr).ok())) {
+            RECORD_INFO("Drop corrupted vlog record %lu\n",
+                        (uint64_t)tmp_struct.actual_vptr);
+            continue;
+          }
+
           auto& record = read_records[count];
-          type = job->vlog_manager_->GetKeyValue(
-              tmp_struct.actual_vptr, keys[count],
-              record.value_slice, seq_num, record.record_index);
-          record.seq_num = (seq_num << 8) | type;
-          record.key = &keys[count++];
+          if (unlikely(!ReadCompactionRecord(
+                  job, tmp_struct.actual_vptr, record).ok())) {
+            RECORD_INFO("Drop corrupted vlog record %lu\n",
+                        (uint64_t)tmp_struct.actual_vptr);
+            continue;
+          }
+          ++count;
           record.s = KVStruct{data[i * 2], data[i * 2 + 1]};
         }
 
-        std::stable_sort(read_records.begin(), read_records.begin() + count);
+        std::sort(read_records.begin(), read_records.begin() + count);
 
-        keys[count] = "";
-        read_records[count].key = &keys[count];
-        for (size_t i = 1; i <= count; ++i) {
+        for (size_t i = 0; i < count; ++i) {
           auto& record = read_records[i];
-          auto& last_record = read_records[i - 1];
-          if (*record.key != *last_record.key) {
-            PutFixed64(last_record.key, last_record.seq_num);
-            job->kv_slices.emplace_back(*last_record.key, last_record.value_slice);
+          if (i > 0 && record == read_records[i - 1] &&
+              !IsPinnedBySnapshot(*snapshots, record.seq_num >> 8,
+                                  read_records[i - 1].seq_num >> 8)) {
+            continue;
           }
+          job->kv_slices.emplace_back(record.key, record.value_slice);
         }
 
         node = node->next_node;
@@ -581,7 +857,8 @@ void Compactor::Reset() {
 
 void ReadData(InnerNode* node, SingleCompactionJob* job,
               int& compacted_size, int rewrite_threshold,
-              std::vector<KVStruct>& rewrite_kv) {
+              std::vector<KVStruct>& rewrite_kv,
+              const std::vector<SequenceNumber>& snapshots) {
   auto nvm_node = node->backup_nvm_node_;
   auto new_nvm_node = node->nvm_node_;
   int data_size = GET_SIZE(nvm_node->meta.header);
@@ -594,12 +871,9 @@ void ReadData(InnerNode* node, SingleCompactionJob* job,
 #endif
 
   KVStruct tmp_struct{};
-  ValueType type;
-  SequenceNumber seq_num;
   int32_t cur_size = 0;
 
-  std::vector<std::string>& keys = job->keys_in_node;
-  std::vector<CompactionRec> read_records(241);
+  auto& read_records = job->read_records;
 
   size_t count = 0;
   for (int i = -16; i < data_size; ++i) {
@@ -608,58 +882,73 @@ void ReadData(InnerNode* node, SingleCompactionJob* job,
       continue;
     }
 
+    if (unlikely(!job->vlog_manager_->VerifyRecord(
+            tmp_struct.actual_vptr).ok())) {
+      RECORD_INFO("Drop corrupted vlog record %lu\n",
+                  (uint64_t)tmp_struct.actual_vptr);
+      continue;
+    }
+
     auto& record = read_records[count];
-    type = job->vlog_manager_->GetKeyValue(
-        tmp_struct.actual_vptr, keys[count],
-        record.value_slice, seq_num, record.record_index);
-    record.seq_num = (seq_num << 8) | type;
-    record.key = &(keys[count]);
-    record.s = KVStruct{data[i * 2], data[i * 2 + 1]};
+    if (unlikely(!ReadCompactionRecord(
+            job, tmp_struct.actual_vptr, record).ok())) {
+      RECORD_INFO("Drop corrupted vlog record %lu\n",
+                  (uint64_t)tmp_struct.actual_vptr);
+      continue;
+    }
     ++count;
+    record.s = KVStruct{data[i * 2], data[i * 2 + 1]};
   }
 
   if (count == 0) {
     return;
   }
 
-  std::stable_sort(read_records.begin(), read_records.begin() + count);
-
-  keys[count] = "";
-  read_records[count].key = &keys[count];
-  int insert_times = 0;
+  std::sort(read_records.begin(), read_records.begin() + count);
 
+  // Records of the same key form a run, newest first. Hot key's newest
+  // version is rewritten into nvm, other versions go to sst if a snapshot
+  // still sees them, and are dropped otherwise, like CompactionIterator.
   size_t rewrite_count = 0;
-  for (size_t i = 1; i <= count; ++i) {
-    auto& record = read_records[i];
-    auto& last_record = read_records[i - 1];
-    insert_times += last_record.s.insert_times;
-
-    if (*record.key == *last_record.key) {
-      job->compacted_indexes[last_record.s.actual_vptr >> 20]
-          .push_back(last_record.record_index);
-    } else {
-      if (insert_times > rewrite_threshold) {
-        last_record.s.insert_times = 1;
-        cur_size += last_record.s.kv_size;
-        nvm_data[rewrite_count * 2] = last_record.s.hash;
-        nvm_data[rewrite_count * 2 + 1] = last_record.s.vptr;
-        fingerprints[rewrite_count++] = static_cast<uint8_t>(last_record.s.actual_hash);
-
-        int bucket = (int)(last_record.s.actual_hash & 63);
-        int h = (int)(last_record.s.actual_hash >> 6);
+  size_t run_start = 0;
+  while (run_start < count) {
+    size_t run_end = run_start + 1;
+    int insert_times = read_records[run_start].s.insert_times;
+    while (run_end < count &&
+           read_records[run_end] == read_records[run_start]) {
+      insert_times += read_records[run_end++].s.insert_times;
+    }
+
+    for (size_t i = run_start; i < run_end; ++i) {
+      auto& record = read_records[i];
+
+      if (i == run_start && insert_times > rewrite_threshold) {
+        record.s.insert_times = 1;
+        cur_size += GetKVSize(record.s);
+        nvm_data[rewrite_count * 2] = record.s.hash;
+        nvm_data[rewrite_count * 2 + 1] = record.s.vptr;
+        fingerprints[rewrite_count++] = static_cast<uint8_t>(record.s.actual_hash);
+
+        int bucket = (int)(record.s.actual_hash & 63);
+        int h = (int)(record.s.actual_hash >> 6);
         uint8_t digit = h == 0 ? 0 : __builtin_ctz(h) + 1;
         node->hll_[bucket] = std::max(node->hll_[bucket], digit);
 
-        Rehash(last_record.s, *last_record.key, parent_level);
-        rewrite_kv.push_back(last_record.s);
-      } else {
-        job->compacted_indexes[last_record.s.actual_vptr >> 20]
-            .push_back(last_record.record_index);
-        PutFixed64(last_record.key, last_record.seq_num);
-        job->kv_slices.emplace_back(*last_record.key, last_record.value_slice);
+        Rehash(record.s, record.user_key(), parent_level);
+        rewrite_kv.push_back(record.s);
+        continue;
+      }
+
+      auto segment_id = job->vlog_manager_->GetSegmentId(record.s.actual_vptr);
+      job->compacted_indexes[segment_id].push_back(record.record_index);
+      if (i == run_start ||
+          IsPinnedBySnapshot(snapshots, record.seq_num >> 8,
+                             read_records[i - 1].seq_num >> 8)) {
+        job->kv_slices.emplace_back(record.key, record.value_slice);
       }
-      insert_times = 0;
     }
+
+    run_start = run_end;
   }
 
   int flush_size = ALIGN_UP(rewrite_count, 16);
@@ -704,6 +993,8 @@ void Compactor::CompactionPreprocess(SingleCompactionJob* job) {
   std::vector<KVStruct> rewrite_kv;
   rewrite_kv.reserve(256);
 
+  auto snapshots = GetLiveSnapshots();
+
   InnerNode* cur_node = start_node->next_node;
   while (cur_node != next_start_node) {
     cur_node->opt_lock_.lock();
@@ -738,7 +1029,8 @@ void Compactor::CompactionPreprocess(SingleCompactionJob* job) {
       children.clear();
     }
 
-    ReadData(cur_node, job, compacted_size, rewrite_threshold_, rewrite_kv);
+    ReadData(cur_node, job, compacted_size, rewrite_threshold_, rewrite_kv,
+             *snapshots);
     cur_node->share_mutex_.unlock();
 
     children.push_back(cur_node);
@@ -757,6 +1049,26 @@ void Compactor::CompactionPreprocess(SingleCompactionJob* job) {
   CompactedSize.fetch_add(compacted_size, std::memory_order_release);
 }
 
+void Compactor::RunCompactionJob(SingleCompactionJob* job) {
+  auto start_time = GetStartTime();
+  ThreadStatusUtil::SetThreadOperation(ThreadStatus::OP_COMPACTION);
+  CompactionPreprocess(job);
+
+  // Operation is switched to OP_FLUSH while sst is built
+  auto preprocess_done_time = GetStartTime();
+  db_impl_->PipelinedCallFlush(job);
+
+  auto flush_done_time = GetStartTime();
+  ThreadStatusUtil::SetThreadOperation(ThreadStatus::OP_COMPACTION);
+  CompactionPostprocess(job);
+  ThreadStatusUtil::ResetThreadStatus();
+  group_manager_->AddOperation(job->group_, kOperatorMove, true);
+
+  job->preprocess_time = (preprocess_done_time - start_time) * 1e-6;
+  job->flush_time = (flush_done_time - preprocess_done_time) * 1e-6;
+  job->postprocess_time = (GetStartTime() - flush_done_time) * 1e-6;
+}
+
 void Compactor::CompactionPostprocess(SingleCompactionJob* job) {
   // remove compacted node form list
   auto cur_node = job->group_->first_node_;
@@ -769,6 +1081,8 @@ void Compactor::CompactionPostprocess(SingleCompactionJob* job) {
   while (candidate && cur_node != node_after_end) {
     std::lock_guard<RWSpinLock> link_lk(cur_node->link_lock_);
     if (cur_node->next_node == candidate) {
+      RetireNVMNode(candidate, candidate->backup_nvm_node_);
+      job->retired_owners.push_back(candidate);
       RemoveOldNVMNode(cur_node);
       candidate = candidates.front();
       candidates.pop_front();
@@ -779,6 +1093,14 @@ void Compactor::CompactionPostprocess(SingleCompactionJob* job) {
   assert(candidates.empty());
 
   for (auto removed : job->candidates_removed) {
+    // Data of removed children is read through their parent, which
+    // takes their place in node list, or through the child itself
+    // by iterators which stand on it.
+    auto parent = removed->parent_node;
+    RetireNVMNode(parent, removed->backup_nvm_node_);
+    RetireNVMNode(removed, removed->backup_nvm_node_);
+    job->retired_owners.push_back(parent);
+    job->retired_owners.push_back(removed);
     GetNodeAllocator()->DeallocateNode(removed->backup_nvm_node_);
     removed->backup_nvm_node_ = nullptr;
   }
@@ -799,11 +1121,14 @@ void TimerCompaction::SetDB(DBImpl* db_impl) {
 
 void TimerCompaction::StopCompaction() {
   this->flag_.store(false);
+  Wakeup();
 }
 
 void TimerCompaction::BGWork() {
   while (flag_.load()) {
-    sleep(interval_);
+    if (!WaitForWork(std::chrono::seconds(interval_)) || !flag_.load()) {
+      break;
+    }
     db_impl_->TryScheduleCompaction();
   }
 }
@@ -7,6 +7,7 @@
 #include <string>
 #include <atomic>
 #include <thread>
+#include <memory>
 #include <mutex>
 #include <deque>
 #include <db/art/utils.h>
@@ -15,6 +16,8 @@
 #include <rocksdb/rocksdb_namespace.h>
 #include <rocksdb/threadpool.h>
 #include <rocksdb/threadpool.h>
+#include <memory/arena.h>
+#include <port/port.h>
 #include <util/autovector.h>
 
 namespace ROCKSDB_NAMESPACE {
@@ -23,26 +26,69 @@ struct NVMNode;
 struct ArtNode;
 struct HeatGroup;
 struct InnerNode;
+struct RetiredNVMNode;
 class DBImpl;
 class VLogManager;
 class GlobalMemtable;
 class HeatGroupManager;
 
-struct SingleCompactionJob {
-  static ThreadPool* thread_pool;
+// Record read from a leaf in compaction.
+struct alignas(CACHE_LINE_SIZE) CompactionRec {
+  Slice        key;         // Internal key, stored in arena of job
+  uint64_t     key_prefix;  // First 8 bytes of user key, big endian
+  Slice        value_slice;
+  uint64_t     seq_num;
+  RecordIndex  record_index;
+  KVStruct     s;
+
+  CompactionRec() = default;
+
+  Slice user_key() const {
+    return Slice(key.data(), key.size() - kNumInternalBytes);
+  }
+
+  // Versions of the same key are ordered from newest to oldest,
+  // keys are only compared when their prefixes are the same.
+  friend bool operator<(const CompactionRec& l, const CompactionRec& r) {
+    if (l.key_prefix != r.key_prefix) {
+      return l.key_prefix < r.key_prefix;
+    }
+    int cmp = l.user_key().compare(r.user_key());
+    return cmp < 0 || (cmp == 0 && l.seq_num > r.seq_num);
+  }
+
+  friend bool operator==(const CompactionRec& l, const CompactionRec& r) {
+    return l.key_prefix == r.key_prefix && l.user_key() == r.user_key();
+  }
+};
 
+// Block size of arena holding keys of a compaction job.
+#define COMPACTION_ARENA_BLOCK_SIZE (1 << 20)
+
+struct SingleCompactionJob {
   HeatGroup*   group_;
   VLogManager* vlog_manager_;
   uint64_t     out_file_size;
   int64_t      oldest_key_time_;
 
+  // Time spent in each stage, in seconds
+  float        preprocess_time;
+  float        flush_time;
+  float        postprocess_time;
+
   std::deque<InnerNode*>   candidates;
   std::vector<InnerNode*>  candidates_removed;
   std::vector<InnerNode*>  candidate_parents;
   std::vector<ArtNode*>    removed_arts;
-  std::vector<std::pair<std::string, Slice>>   kv_slices;
-
-  std::vector<std::string> keys_in_node;
+  std::vector<InnerNode*>  retired_owners;
+  // Internal keys point to arena, values point to vlog
+  // or uncompressed_values.
+  std::vector<std::pair<Slice, Slice>> kv_slices;
+
+  std::unique_ptr<Arena>     arena;
+  std::vector<CompactionRec> read_records;
+  // Values in kv_slices uncompressed from vlog
+  std::deque<std::string>  uncompressed_values;
   autovector<RecordIndex>* compacted_indexes;
 
   void Reset() {
@@ -50,10 +96,26 @@ struct SingleCompactionJob {
     candidates_removed.clear();
     candidate_parents.clear();
     removed_arts.clear();
+    retired_owners.clear();
     kv_slices.clear();
+    uncompressed_values.clear();
+    // Keys of last compaction have been flushed to sst
+    arena.reset(new Arena(COMPACTION_ARENA_BLOCK_SIZE));
   }
 };
 
+// Resources unlinked before epoch, they are recycled after all iterators
+// pinned at or before epoch have been deleted.
+struct ReclaimBatch {
+  uint64_t                     epoch = 0;
+  size_t                       num_nvm_nodes = 0;
+  size_t                       num_segments = 0;
+  std::vector<ArtNode*>        arts;
+  std::vector<InnerNode*>      inner_nodes;
+  std::vector<InnerNode*>      owners;
+  std::vector<RetiredNVMNode*> retired_nvm_nodes;
+};
+
 class Compactor : public BackgroundThread {
  public:
   explicit Compactor(const DBOptions& options);
@@ -74,15 +136,26 @@ class Compactor : public BackgroundThread {
     return num_parallel_compaction_;
   }
 
+  // Runs compaction jobs and builds their sst files,
+  // see DBOptions::num_compaction_threads.
+  ThreadPool* GetThreadPool() const {
+    return thread_pool_;
+  }
+
   static int64_t compaction_threshold_;
 
  private:
   void BGWork() override;
 
+  // Read and sort, build sst, install it and remove compacted nodes.
+  void RunCompactionJob(SingleCompactionJob* job);
+
   void CompactionPreprocess(SingleCompactionJob* job);
 
   void CompactionPostprocess(SingleCompactionJob* job);
 
+  void ReclaimResources();
+
   HeatGroupManager* group_manager_ = nullptr;
 
   VLogManager* vlog_manager_ = nullptr;
@@ -93,6 +166,8 @@ class Compactor : public BackgroundThread {
 
   int rewrite_threshold_;
 
+  ThreadPool* thread_pool_;
+
   std::vector<HeatGroup*> chosen_groups_;
 
   std::vector<SingleCompactionJob*> chosen_jobs_;
@@ -100,6 +175,20 @@ class Compactor : public BackgroundThread {
   std::vector<SingleCompactionJob*> compaction_jobs_;
 
   std::vector<std::vector<RecordIndex>> all_compacted_indexes_;
+
+  // Resources retired by the last compaction, not sealed into a batch yet
+  std::vector<ArtNode*> retired_arts_;
+
+  std::vector<InnerNode*> retired_owners_;
+
+  std::vector<RetiredNVMNode*> unlinked_retired_;
+
+  std::deque<ReclaimBatch> reclaim_batches_;
+
+  // Number of nvm nodes and vlog segments held by reclaim batches
+  size_t pending_nvm_nodes_ = 0;
+
+  size_t pending_segments_ = 0;
 };
 
 int64_t GetMemTotalSize();
@@ -113,11 +202,36 @@ void IncrementBackupRead();
 
 void ReduceBackupRead();
 
-// Before creating db iterator, we must notify compactor that
-// we want to do scan operation. Because we can't do compaction when doing scan.
-void TryCreateIterator();
+// Iterators pin current epoch instead of blocking compaction, nodes
+// and vlog segments unlinked by compaction or gc are recycled only after
+// every iterator pinned at or before the epoch they were unlinked in
+// has been deleted.
+uint64_t PinIteratorEpoch();
+
+void UnpinIteratorEpoch(uint64_t epoch);
+
+uint64_t GetIteratorEpoch();
+
+// Live snapshots are published by DBImpl in ascending order,
+// squeeze and compaction keep versions still visible to them.
+void SetLiveSnapshots(std::vector<SequenceNumber>&& snapshots);
+
+std::shared_ptr<const std::vector<SequenceNumber>> GetLiveSnapshots();
+
+// Return true if a snapshot sees the version of seq, whose next newer
+// version of the same key is newer_seq, i.e. seq <= snapshot < newer_seq.
+bool IsPinnedBySnapshot(const std::vector<SequenceNumber>& snapshots,
+                        SequenceNumber seq, SequenceNumber newer_seq);
+
+// Wake up compactor to reclaim resources or choose compaction.
+void WakeupCompactor();
+
+// Inner node unlinked from node list, it is deleted by compactor.
+void RetireInnerNode(InnerNode* node);
 
-void DeleteIterator();
+// Keep nvm node detached by compaction readable by iterators pinned
+// no later than now, it is unlinked once they are all deleted.
+void RetireNVMNode(InnerNode* owner, NVMNode* nvm_node);
 
 
 class TimerCompaction : public BackgroundThread {
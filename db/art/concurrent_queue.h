@@ -6,9 +6,13 @@
 
 #include "rocksdb/rocksdb_namespace.h"
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <deque>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 #include "db/art/rwspinlock.h"
 
 #include "heat_group.h"
@@ -72,6 +76,30 @@ class TQueueConcurrent {
     return elem;
   }
 
+  /** @brief  Like pop_front, but gives up if the collection is still empty
+              after timeout, return false then.
+  **/
+  template<class Rep, class Period>
+  bool pop_front_for( T& elem,
+                      const std::chrono::duration<Rep, Period>& timeout )
+  {
+    std::unique_lock<std::mutex> lock{_mutex};
+    if (!_condNewData.wait_for(lock, timeout,
+                               [this] { return !_collection.empty(); })) {
+      return false;
+    }
+    elem = std::move(_collection.front());
+    _collection.pop_front();
+    return true;
+  }
+
+  //! @brief Wait until the collection holds at least count elements
+  void wait_for_size( size_type count )
+  {
+    std::unique_lock<std::mutex> lock{_mutex};
+    _condNewData.wait(lock, [&] { return _collection.size() >= count; });
+  }
+
  private:
 
   /** @brief  Protects the deque, calls the provided function and notifies the presence of new data
@@ -84,7 +112,8 @@ class TQueueConcurrent {
     std::unique_lock<std::mutex> lock{ _mutex };
     fct();
     lock.unlock();
-    _condNewData.notify_one();
+    // Both pop_front and wait_for_size may be waiting
+    _condNewData.notify_all();
   }
 
   std::deque<T> _collection;                     ///< Concrete, not thread safe, storage.
@@ -99,101 +128,159 @@ template class TQueueConcurrent<GroupOperation>;
 
 template class TQueueConcurrent<char *>;
 
+// Used segments ordered by cost-benefit of gc, as in LFS:
+// benefit / cost = (1 - u) * age / (1 + u), where u is the ratio of
+// live records in segment, and age is the number of segments sealed
+// after it. Segments are kept in an indexed max heap, score of a segment
+// is updated when it gets garbage, and all scores are refreshed every
+// kRefreshInterval sealed segments, because age keeps growing.
 class SegmentQueue {
  public:
-  SegmentQueue(int max_count) {
-    count_ = max_count * 2;
-    queue_ = new int[max_count * 2];
-    for (int i = 0; i < count_; ++i) {
-      queue_[i] = -1;
-      garbage_count_[i] = 0;
+  explicit SegmentQueue(int max_count)
+      : pos_(max_count, -1), total_count_(max_count, 0),
+        garbage_count_(max_count, 0), sealed_time_(max_count, 0),
+        score_(max_count, 0.0) {
+    heap_.reserve(max_count);
+  }
+
+  // Return segment with the highest score, -1 if there is no used segment.
+  int GetSegment() {
+    std::lock_guard<RWSpinLock> lk(lock_);
+    if (clock_ - refresh_clock_ >= kRefreshInterval) {
+      RefreshScores();
     }
 
-    vptr_map = std::vector<std::unordered_map<uint32_t, uint64_t>>(1024);
-    for (int i = 0; i < 1024; ++i) {
-      vptr_map[i].clear();
+    if (heap_.empty()) {
+      return -1;
     }
+
+    int segment_id = heap_.front();
+    Swap(0, heap_.size() - 1);
+    heap_.pop_back();
+    pos_[segment_id] = -1;
+    if (!heap_.empty()) {
+      SiftDown(0);
+    }
+    return segment_id;
   }
 
-  ~SegmentQueue() {
-    delete[] queue_;
+  // Segment is sealed with total_count records.
+  void PushSegment(int segment_id, int total_count) {
+    std::lock_guard<RWSpinLock> lk(lock_);
+    assert(pos_[segment_id] == -1);
+    total_count_[segment_id] = total_count;
+    sealed_time_[segment_id] = ++clock_;
+    score_[segment_id] = ComputeScore(segment_id);
+    pos_[segment_id] = static_cast<int>(heap_.size());
+    heap_.push_back(segment_id);
+    SiftUp(heap_.size() - 1);
   }
 
-  int GetSegment() {
-    auto tail = tail_.load(std::memory_order_relaxed);
-    int check_count = (tail - head_) / 16;
-
-    int max_garbage_count = 0;
-    int chosen_slot = -1;
-    int chosen_segment = -1;
-
-    for (int i = head_; i < head_ + check_count; ++i) {
-      int slot = i % count_;
-      int segment_id = queue_[slot];
-
-      if (segment_id != -1 && garbage_count_[segment_id] > max_garbage_count) {
-        chosen_slot = slot;
-        chosen_segment = segment_id;
-        max_garbage_count =
-            garbage_count_[segment_id].load(std::memory_order_relaxed);
-      }
+  void Clear() {
+    std::lock_guard<RWSpinLock> lk(lock_);
+    for (auto segment_id : heap_) {
+      pos_[segment_id] = -1;
     }
+    heap_.clear();
+    std::fill(garbage_count_.begin(), garbage_count_.end(), 0);
+    clock_ = refresh_clock_ = 0;
+  }
 
-    // prune
-    while (queue_[head_ % count_] == -1) {
-      ++head_;
-    }
+  void ClearGarbage(int segment_id) {
+    std::lock_guard<RWSpinLock> lk(lock_);
+    garbage_count_[segment_id] = 0;
+  }
 
-    if (unlikely(chosen_slot == -1)) {
-      chosen_slot = (head_++) % count_;
-      chosen_segment = queue_[chosen_slot];
+  // count records of segment become garbage.
+  void AddGarbage(int segment_id, int count) {
+    std::lock_guard<RWSpinLock> lk(lock_);
+    garbage_count_[segment_id] += count;
+    int pos = pos_[segment_id];
+    if (pos != -1) {
+      score_[segment_id] = ComputeScore(segment_id);
+      SiftUp(pos);
+      SiftDown(pos_[segment_id]);
     }
+  }
 
-    assert(chosen_segment >= 0);
-    queue_[chosen_slot] = -1;
-    return chosen_segment;
+ private:
+  static constexpr uint64_t kRefreshInterval = 64;
+
+  double ComputeScore(int segment_id) const {
+    int total = total_count_[segment_id];
+    double u = total > 0
+        ? 1.0 - std::min(garbage_count_[segment_id], total) / (double)total
+        : 0.0;
+    double age = (double)(clock_ - sealed_time_[segment_id] + 1);
+    return (1.0 - u) * age / (1.0 + u);
   }
 
-  void PushSegment(int segment_id) {
-    int cur_tail = tail_.load(std::memory_order_relaxed);
-    while (!tail_.compare_exchange_strong(cur_tail, cur_tail + 1));
-    queue_[(cur_tail - 1) % count_] = segment_id;
+  void RefreshScores() {
+    refresh_clock_ = clock_;
+    for (auto segment_id : heap_) {
+      score_[segment_id] = ComputeScore(segment_id);
+    }
+    for (size_t i = heap_.size() / 2; i-- > 0;) {
+      SiftDown(i);
+    }
   }
 
-  void ClearGarbage(int segment_id) {
-    garbage_count_[segment_id] = 0;
+  void Swap(size_t i, size_t j) {
+    std::swap(heap_[i], heap_[j]);
+    pos_[heap_[i]] = static_cast<int>(i);
+    pos_[heap_[j]] = static_cast<int>(j);
   }
 
-  void AddGarbage(uint32_t hash, uint64_t vptr) {
-    auto bucket_id = hash & 1023;
-    std::lock_guard<RWSpinLock> lk(map_locks[bucket_id]);
-    auto& map = vptr_map[bucket_id];
-    auto iter = map.find(hash);
-    if (unlikely(iter == map.end())) {
-      map[hash] = vptr;
-      return;
+  void SiftUp(size_t i) {
+    while (i > 0) {
+      size_t parent = (i - 1) / 2;
+      if (score_[heap_[parent]] >= score_[heap_[i]]) {
+        break;
+      }
+      Swap(i, parent);
+      i = parent;
     }
+  }
 
-    auto old_vptr = iter->second;
-    map[hash] = vptr;
-    ++garbage_count_[old_vptr >> 20];
+  void SiftDown(size_t i) {
+    size_t size = heap_.size();
+    while (true) {
+      size_t largest = i;
+      size_t left = i * 2 + 1;
+      size_t right = left + 1;
+      if (left < size && score_[heap_[left]] > score_[heap_[largest]]) {
+        largest = left;
+      }
+      if (right < size && score_[heap_[right]] > score_[heap_[largest]]) {
+        largest = right;
+      }
+      if (largest == i) {
+        break;
+      }
+      Swap(i, largest);
+      i = largest;
+    }
   }
 
- private:
-  int head_ = 0;
+  RWSpinLock lock_;
+
+  // Logical time, increased when a segment is sealed
+  uint64_t clock_ = 0;
 
-  std::atomic<int> tail_{1};
+  uint64_t refresh_clock_ = 0;
 
-  int count_;
+  std::vector<int> heap_;
 
-  int* queue_;
+  // Position of segment in heap_, -1 if segment is not in it
+  std::vector<int> pos_;
 
-  std::atomic<int> garbage_count_[8192];
+  std::vector<int> total_count_;
 
-  std::vector<std::unordered_map<uint32_t, uint64_t>> vptr_map;
+  std::vector<int> garbage_count_;
 
-  RWSpinLock map_locks[1024];
+  std::vector<uint64_t> sealed_time_;
 
+  std::vector<double> score_;
 };
 
 }  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,164 @@
+//
+// Tests of SegmentQueue, which orders used vlog segments for gc.
+//
+
+#include "db/art/concurrent_queue.h"
+
+#include <atomic>
+#include <vector>
+
+#include "port/port.h"
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class SegmentQueueTest : public testing::Test {};
+
+TEST_F(SegmentQueueTest, Empty) {
+  SegmentQueue queue(16);
+  ASSERT_EQ(-1, queue.GetSegment());
+  queue.PushSegment(3, 100);
+  ASSERT_EQ(3, queue.GetSegment());
+  ASSERT_EQ(-1, queue.GetSegment());
+}
+
+TEST_F(SegmentQueueTest, MoreGarbageFirst) {
+  SegmentQueue queue(16);
+  for (int i = 0; i < 8; i++) {
+    queue.PushSegment(i, 100);
+  }
+  queue.AddGarbage(2, 10);
+  queue.AddGarbage(5, 90);
+  queue.AddGarbage(6, 50);
+
+  ASSERT_EQ(5, queue.GetSegment());
+  ASSERT_EQ(6, queue.GetSegment());
+  ASSERT_EQ(2, queue.GetSegment());
+  // Segments without garbage are left, all of them are still returned.
+  std::vector<bool> seen(8, false);
+  for (int i = 0; i < 5; i++) {
+    int segment_id = queue.GetSegment();
+    ASSERT_GE(segment_id, 0);
+    ASSERT_FALSE(seen[segment_id]);
+    seen[segment_id] = true;
+  }
+  ASSERT_EQ(-1, queue.GetSegment());
+}
+
+TEST_F(SegmentQueueTest, OlderFirst) {
+  SegmentQueue queue(16);
+  for (int i = 0; i < 4; i++) {
+    queue.PushSegment(i, 100);
+  }
+  // Same ratio of garbage, the oldest segment benefits most.
+  for (int i = 3; i >= 0; i--) {
+    queue.AddGarbage(i, 50);
+  }
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(i, queue.GetSegment());
+  }
+}
+
+TEST_F(SegmentQueueTest, GarbageBeforePush) {
+  SegmentQueue queue(16);
+  queue.PushSegment(0, 100);
+  queue.AddGarbage(0, 20);
+  // Garbage of a segment being written counts once it's sealed.
+  queue.AddGarbage(1, 80);
+  queue.PushSegment(1, 100);
+  ASSERT_EQ(1, queue.GetSegment());
+  ASSERT_EQ(0, queue.GetSegment());
+
+  queue.ClearGarbage(0);
+  queue.ClearGarbage(1);
+  queue.PushSegment(1, 100);
+  queue.PushSegment(0, 100);
+  queue.AddGarbage(0, 10);
+  ASSERT_EQ(0, queue.GetSegment());
+}
+
+TEST_F(SegmentQueueTest, GarbageExceedsTotal) {
+  SegmentQueue queue(16);
+  queue.PushSegment(0, 10);
+  queue.PushSegment(1, 10);
+  queue.AddGarbage(0, 100);
+  queue.AddGarbage(1, 9);
+  ASSERT_EQ(0, queue.GetSegment());
+  ASSERT_EQ(1, queue.GetSegment());
+}
+
+TEST_F(SegmentQueueTest, Clear) {
+  SegmentQueue queue(16);
+  for (int i = 0; i < 16; i++) {
+    queue.PushSegment(i, 100);
+    queue.AddGarbage(i, i);
+  }
+  queue.Clear();
+  ASSERT_EQ(-1, queue.GetSegment());
+
+  // Garbage is cleared too, segments can be pushed again.
+  queue.PushSegment(7, 100);
+  queue.PushSegment(15, 100);
+  queue.AddGarbage(7, 1);
+  ASSERT_EQ(7, queue.GetSegment());
+  ASSERT_EQ(15, queue.GetSegment());
+}
+
+TEST_F(SegmentQueueTest, RefreshScores) {
+  SegmentQueue queue(256);
+  queue.PushSegment(0, 100);
+  queue.AddGarbage(0, 50);
+  for (int i = 1; i < 200; i++) {
+    queue.PushSegment(i, 100);
+  }
+  queue.AddGarbage(1, 20);
+  // Score of segment 0 was computed while it was young, it's the oldest
+  // one once scores are refreshed.
+  ASSERT_EQ(0, queue.GetSegment());
+  ASSERT_EQ(1, queue.GetSegment());
+}
+
+TEST_F(SegmentQueueTest, ConcurrentGarbage) {
+  const int kNumSegments = 1024;
+  const int kNumThreads = 4;
+  SegmentQueue queue(kNumSegments);
+  for (int i = 0; i < kNumSegments; i++) {
+    queue.PushSegment(i, 1000);
+  }
+
+  std::vector<std::atomic<int>> popped(kNumSegments);
+  for (auto& count : popped) {
+    count.store(0);
+  }
+  std::vector<port::Thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = t; i < kNumSegments; i += kNumThreads) {
+        queue.AddGarbage(i, i % 1000);
+        if (i % 2 == 0) {
+          int segment_id = queue.GetSegment();
+          ASSERT_GE(segment_id, 0);
+          popped[segment_id]++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  int segment_id;
+  while ((segment_id = queue.GetSegment()) != -1) {
+    popped[segment_id]++;
+  }
+  for (int i = 0; i < kNumSegments; i++) {
+    ASSERT_EQ(1, popped[i].load());
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
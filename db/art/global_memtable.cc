@@ -6,8 +6,6 @@
 
 #include <cassert>
 #include <unordered_map>
-#include <fcntl.h>
-#include <unistd.h>
 
 #include <db/write_batch_internal.h>
 
@@ -19,6 +17,7 @@
 #include "heat_group_manager.h"
 #include "node_allocator.h"
 #include "compactor.h"
+#include "simd_probe.h"
 
 namespace ROCKSDB_NAMESPACE {
 
@@ -27,53 +26,82 @@ namespace ROCKSDB_NAMESPACE {
 InnerNode::InnerNode()
     : heat_group_(nullptr), art(nullptr), backup_art(nullptr),
       nvm_node_(nullptr), backup_nvm_node_(nullptr),
-      support_node(nullptr),
-      next_node(nullptr),
-      vptr_(0), estimated_size_(0), squeezed_size_(0),
-      status_(INITIAL_STATUS(0)), oldest_key_time_(0) {
+      retired_nvm_nodes_(nullptr), support_node(nullptr),
+      next_node(nullptr), prev_node(nullptr),
+      vptr_(0), old_versions_(nullptr), estimated_size_(0),
+      squeezed_size_(0), status_(INITIAL_STATUS(0)), oldest_key_time_(0) {
   memset(hll_, 0, 64);
   memset(buffer_, 0, 256);
 }
 
+InnerNode::~InnerNode() {
+  ClearOldVersions();
+}
+
+void InnerNode::ClearOldVersions() {
+  while (old_versions_) {
+    auto version = old_versions_;
+    old_versions_ = version->next;
+    delete version;
+  }
+}
+
 #ifdef ROCKSDB_SUPPORT_THREAD_LOCAL
-thread_local uint8_t fingerprints_copy[16];
+thread_local uint8_t fingerprints_copy[NVM_MAX_SIZE];
+thread_local uint64_t staged_rows[NVM_MAX_SIZE * 2];
 #endif
 
-void FlushBuffer(InnerNode* leaf, int row) {
+static inline void UpdateFingerprintAndHLL(uint64_t hash, uint8_t* hll,
+                                           uint8_t& fingerprint) {
+  KVStruct s{};
+  s.hash = hash;
+  auto actual_hash = s.actual_hash;
+
+  fingerprint = static_cast<uint8_t>(actual_hash);
+  int bucket = (int)(actual_hash & 63);
+  int h = (int)(actual_hash >> 6);
+  uint8_t digit = unlikely(h == 0) ? 0 : __builtin_ctz(h) + 1;
+  hll[bucket] = std::max(hll[bucket], digit);
+}
+
+// Flush buffer of leaf to row, extra_rows full rows staged in rows_data
+// are flushed right after it, so that all rows share one barrier.
+void FlushBuffer(InnerNode* leaf, int row,
+                 const uint64_t* rows_data = nullptr, int extra_rows = 0) {
   NVMNode* node = leaf->nvm_node_;
   uint8_t* hll = leaf->hll_;
 
 #ifndef ROCKSDB_SUPPORT_THREAD_LOCAL
-  uint8_t fingerprints_copy[16];
+  uint8_t fingerprints_copy[NVM_MAX_SIZE];
 #endif
 
-  KVStruct s{};
-
-  int h, bucket;
-  uint8_t digit;
-  for (size_t i = 0; i < 16; ++i) {
-    s.hash = leaf->buffer_[i * 2];
-    auto actual_hash = s.actual_hash;
-
-    fingerprints_copy[i] = static_cast<uint8_t>(actual_hash);
-    bucket = (int)(actual_hash & 63);
-    h = (int)(actual_hash >> 6);
-    digit = unlikely(h == 0) ? 0 : __builtin_ctz(h) + 1;
-    hll[bucket] = std::max(hll[bucket], digit);
+  for (size_t i = 0; i < ROW_SIZE; ++i) {
+    UpdateFingerprintAndHLL(leaf->buffer_[i * 2], hll, fingerprints_copy[i]);
+  }
+  for (int i = 0; i < ROW_TO_SIZE(extra_rows); ++i) {
+    UpdateFingerprintAndHLL(rows_data[i * 2], hll,
+                            fingerprints_copy[ROW_SIZE + i]);
   }
 
   uint64_t* data_flush_start = node->data + (row << 5);
   uint8_t* finger_flush_start = node->meta.fingerprints_ + ROW_TO_SIZE(row);
-  MEMCPY(data_flush_start, leaf->buffer_, ROW_BYTES, PMEM_F_MEM_NONTEMPORAL);
+  if (extra_rows) {
+    MEMCPY(data_flush_start, leaf->buffer_, ROW_BYTES,
+           PMEM_F_MEM_NODRAIN | PMEM_F_MEM_NONTEMPORAL);
+    MEMCPY(data_flush_start + 32, rows_data, ROW_BYTES * extra_rows,
+           PMEM_F_MEM_NONTEMPORAL);
+  } else {
+    MEMCPY(data_flush_start, leaf->buffer_, ROW_BYTES, PMEM_F_MEM_NONTEMPORAL);
+  }
   NVM_BARRIER;
-  MEMCPY(finger_flush_start, fingerprints_copy, ROW_SIZE,
+  MEMCPY(finger_flush_start, fingerprints_copy, ROW_TO_SIZE(1 + extra_rows),
          PMEM_F_MEM_NODRAIN | PMEM_F_MEM_NONTEMPORAL);
 
   // Write metadata
   uint64_t hdr = node->meta.header;
   uint8_t size = GET_SIZE(hdr);
-  SET_SIZE(hdr, size + ROW_SIZE);
-  SET_ROWS(hdr, row + 1);
+  SET_SIZE(hdr, size + ROW_TO_SIZE(1 + extra_rows));
+  SET_ROWS(hdr, row + 1 + extra_rows);
   node->meta.header = hdr;
   PERSIST(node, CACHE_LINE_SIZE);
 
@@ -85,21 +113,15 @@ void FlushBuffer(InnerNode* leaf, int row) {
 
 GlobalMemtable::GlobalMemtable(
     VLogManager* vlog_manager, HeatGroupManager* group_manager,
-    Env* env, bool recovery)
+    Env* env, bool recovery, int num_recovery_threads)
     : root_(nullptr), tail_(nullptr), vlog_manager_(vlog_manager),
       group_manager_(group_manager), env_(env) {
   vlog_manager->SetMemtable(this);
-  recovery ? Recovery() : InitFirstLevel();
+  recovery ? Recovery(num_recovery_threads) : InitFirstLevel();
 }
 
 GlobalMemtable::~GlobalMemtable() {
-  uint64_t inode_vptrs[262144] = {0};
-  int count = 0;
-  DeleteInnerNode(root_, inode_vptrs, count);
-
-  int fd = open("inode_vptrs", O_CREAT | O_RDWR | O_DIRECT, 0666);
-  write(fd, inode_vptrs, 2097152);
-  close(fd);
+  DeleteInnerNode(root_);
 }
 
 void CheckHeatGroup(HeatGroup* group) {
@@ -122,31 +144,42 @@ void CheckHeatGroup(HeatGroup* group) {
   }
 }
 
-InnerNode* GlobalMemtable::RecoverNonLeaf(InnerNode* parent, int level,
-                                          HeatGroup*& group) {
-  NVMNode* cur = parent->nvm_node_;
-  parent->vptr_ = cur->meta.node_info;
+InnerNode* GlobalMemtable::RecoverNonLeaf(
+    std::vector<InnerNode*>& nodes, size_t& pos, int level,
+    HeatGroup*& group, std::vector<RecoveredNonLeaf>& non_leaves) {
+  InnerNode* parent = nodes[pos];
   parent->heat_group_ = group;
   SET_NON_LEAF(parent);
+  parent->estimated_size_ = 0;
+  parent->vptr_ = parent->nvm_node_->meta.node_info;
 
-  std::vector<InnerNode*> children;
-  std::vector<unsigned char> prefixes;
+  // Refer by index, non_leaves grows in recursion
+  size_t index = non_leaves.size();
+  non_leaves.push_back({parent, {}, {}});
   InnerNode* last_inner_node = parent;
 
   while (true) {
-    cur = GetNextNode(cur);
+    assert(pos + 1 < nodes.size());
+    auto inner_node = nodes[++pos];
+    NVMNode* cur = inner_node->nvm_node_;
 
     int cur_level = GET_LEVEL(cur->meta.header);
     if (cur_level > level) {
+      // It was counted as a leaf, but node_info of non-leaf node is vptr.
+      group->group_size_.fetch_sub(last_inner_node->estimated_size_);
+      UpdateTotalSize(-last_inner_node->estimated_size_);
       SET_NON_LEAF(last_inner_node);
-      last_inner_node = RecoverNonLeaf(last_inner_node, cur_level, group);
-      cur = GetNextNode(last_inner_node->nvm_node_);
+      --pos;
+      last_inner_node = RecoverNonLeaf(nodes, pos, cur_level, group,
+                                       non_leaves);
+      inner_node = nodes[++pos];
+      cur = inner_node->nvm_node_;
     }
 
-    auto inner_node = RecoverInnerNode(cur);
     inner_node->heat_group_ = group;
     inner_node->parent_node = parent;
     last_inner_node->next_node = inner_node;
+    inner_node->prev_node = last_inner_node;
     group->last_node_ = last_inner_node;
     group->group_size_.fetch_add(inner_node->estimated_size_);
     UpdateTotalSize(inner_node->estimated_size_);
@@ -169,15 +202,14 @@ InnerNode* GlobalMemtable::RecoverNonLeaf(InnerNode* parent, int level,
 
     if (GET_TAG(cur->meta.header, DUMMY_TAG)) {
       assert((int)GET_LEVEL(cur->meta.header) == level);
-      parent->art = AllocateArtAfterSplit(children, prefixes);
       parent->support_node = inner_node;
       return inner_node;
     }
 
     assert((int)GET_LEVEL(inner_node->nvm_node_->meta.header) == level);
     auto prefix = GET_LAST_PREFIX(cur->meta.header);
-    children.push_back(inner_node);
-    prefixes.push_back(prefix);
+    non_leaves[index].children.push_back(inner_node);
+    non_leaves[index].prefixes.push_back(prefix);
     last_inner_node = inner_node;
   }
 
@@ -185,22 +217,36 @@ InnerNode* GlobalMemtable::RecoverNonLeaf(InnerNode* parent, int level,
 }
 
 void GlobalMemtable::Reset() {
-  uint64_t inode_vptrs[262144] = {0};
-  int count = 0;
-  DeleteInnerNode(root_, inode_vptrs, count);
+  DeleteInnerNode(root_);
   tail_ = root_ = nullptr;
   InitFirstLevel();
 }
 
-void GlobalMemtable::Recovery() {
-  root_ = RecoverInnerNode(GetNodeAllocator()->GetHead());
+void GlobalMemtable::Recovery(int num_threads) {
+  std::vector<NVMNode*> nvm_nodes;
+  GetNodeAllocator()->TakeRecoveredNodes(nvm_nodes);
+  assert(!nvm_nodes.empty() && nvm_nodes[0] == GetNodeAllocator()->GetHead());
+
+  // Restoring buffer and hll of a node doesn't depend on the others
+  std::vector<InnerNode*> nodes(nvm_nodes.size());
+  ParallelFor(nodes.size(), num_threads, 1024,
+              [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                  nodes[i] = RecoverInnerNode(nvm_nodes[i]);
+                }
+              });
+
+  root_ = nodes[0];
   SET_ART_FULL(root_);
   SET_GROUP_START(root_);
 
   HeatGroup* group = new HeatGroup;
   group->first_node_ = root_;
 
-  tail_ = RecoverNonLeaf(root_, 1, group);
+  size_t pos = 0;
+  std::vector<RecoveredNonLeaf> non_leaves;
+  tail_ = RecoverNonLeaf(nodes, pos, 1, group, non_leaves);
+  assert(pos + 1 == nodes.size());
   assert(tail_->heat_group_->first_node_->next_node == tail_);
 
   group->group_manager_ = group_manager_;
@@ -208,6 +254,23 @@ void GlobalMemtable::Recovery() {
   //group_manager_->InsertIntoLayer(group, BASE_LAYER);
   group_manager_->InsertIntoLayer(group, TEMP_LAYER);
 
+  // Arts and hashes of vptrs are rebuilt after linking, hashing reads
+  // keys in vlog, which is the slowest part for non-leaf nodes.
+  ParallelFor(non_leaves.size(), num_threads, 64,
+              [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                  auto& non_leaf = non_leaves[i];
+                  auto parent = non_leaf.node;
+                  parent->art = AllocateArtAfterSplit(non_leaf.children,
+                                                      non_leaf.prefixes);
+                  if (parent->vptr_) {
+                    Slice key;
+                    vlog_manager_->GetKey(parent->vptr_, key);
+                    parent->hash_ = HashAndPrefix(key, key.size());
+                  }
+                }
+              });
+
 #ifndef NDEBUG
   auto cur = root_;
   while (cur->next_node) {
@@ -216,18 +279,6 @@ void GlobalMemtable::Recovery() {
   assert(cur == tail_);
   assert((char*)(tail_->nvm_node_) - (char*)(root_->nvm_node_) == PAGE_SIZE);
 #endif
-
-  // Recover vptr in leaf nodes
-  uint64_t inode_vptrs[262144] = {0};
-  int fd = open("inode_vptrs", O_CREAT | O_RDWR | O_DIRECT, 0666);
-  read(fd, inode_vptrs, 2097152);
-  close(fd);
-
-  int count = 0;
-  while (count < 262144 && inode_vptrs[count]) {
-    PutRecover(inode_vptrs[count++]);
-  }
-
 }
 
 void GlobalMemtable::InitFirstLevel() {
@@ -282,6 +333,7 @@ void GlobalMemtable::InitFirstLevel() {
   }
 
   root_->next_node = next_inner_node;
+  next_inner_node->prev_node = root_;
   root_->nvm_node_->meta.next1 =
       GetNodeAllocator()->relative(next_inner_node->nvm_node_);
 
@@ -290,31 +342,15 @@ void GlobalMemtable::InitFirstLevel() {
   NVM_BARRIER;
 }
 
-void GlobalMemtable::PutRecover(uint64_t vptr) {
-  Slice key;
-  vlog_manager_->GetKey(vptr, key);
-
-  size_t level = 0;
-  size_t max_level = key.size();
-  InnerNode* current = root_;
-
-  while (true) {
-    current = FindChild(current, key[++level]);
-    if (level == max_level) {
-      current->hash_ = HashAndPrefix(key, level);
-      current->vptr_ = vptr;
-      return;
-    }
-  }
-}
-
-void GlobalMemtable::Put(Slice& slice, uint64_t base_vptr, size_t count) {
-  uint64_t vptr = base_vptr;
+static void ParseBatch(const ArtPutBatch& batch,
+                       std::vector<ArtPutRecord>& records) {
+  uint64_t vptr = batch.vptr;
   uint32_t val_len = 0;
+  Slice slice = batch.contents;
   Slice key;
 
   slice.remove_prefix(WriteBatchInternal::kHeader);
-  for (size_t c = 0; c < count; ++c) {
+  for (size_t c = 0; c < batch.count; ++c) {
     auto record_start = slice.data();
     ValueType type = ((ValueType*)slice.data())[0];
     slice.remove_prefix(WriteBatchInternal::kRecordPrefixSize);
@@ -324,27 +360,75 @@ void GlobalMemtable::Put(Slice& slice, uint64_t base_vptr, size_t count) {
       slice.remove_prefix(val_len);
     }
 
+    size_t record_size = slice.data() - record_start;
     KVStruct kv_info(0, vptr);
     kv_info.insert_times = 1;
-    kv_info.kv_size = slice.data() - record_start;
+    SetKVSize(kv_info, record_size);
     HashOnly(kv_info, key);
 
     assert(kv_info.insert_times == 1);
     assert(kv_info.actual_vptr == vptr);
 
-    Put(key, kv_info);
-    vptr += kv_info.kv_size;
+    records.push_back({key, kv_info});
+    vptr += record_size;
   }
 }
 
-void GlobalMemtable::Put(Slice& key, KVStruct& kv_info) {
+void GlobalMemtable::Put(Slice& slice, uint64_t base_vptr, size_t count) {
+  ArtPutBatch batch{slice, base_vptr, count};
+  MultiPut(&batch, 1);
+}
+
+void GlobalMemtable::MultiPut(const ArtPutBatch* batches, size_t num_batches) {
+  size_t total = 0;
+  for (size_t b = 0; b < num_batches; ++b) {
+    total += batches[b].count;
+  }
+
+  std::vector<ArtPutRecord> records;
+  records.reserve(total);
+  for (size_t b = 0; b < num_batches; ++b) {
+    ParseBatch(batches[b], records);
+  }
+
+  // Stable sort keeps versions of the same key in write order,
+  // so newer version is still inserted later.
+  std::stable_sort(records.begin(), records.end(),
+                   [](const ArtPutRecord& l, const ArtPutRecord& r) {
+                     return l.key.compare(r.key) < 0;
+                   });
+
+  size_t i = 0;
+  size_t level = 0;
+  while (i < records.size()) {
+    InnerNode* leaf =
+        FindLeafForInsert(records[i].key, records[i].kv_info, level);
+    if (!leaf) {
+      ++i;
+      continue;
+    }
+
+    // Following records sharing prefix of leaf fall into the same leaf.
+    auto& prefix = records[i].key;
+    size_t end = i + 1;
+    while (end < records.size() && records[end].key.size() >= level &&
+           memcmp(records[end].key.data(), prefix.data(), level) == 0) {
+      ++end;
+    }
+
+    i += InsertIntoLeaf(leaf, records.data() + i, end - i, level);
+  }
+}
+
+InnerNode* GlobalMemtable::FindLeafForInsert(Slice& key, KVStruct& kv_info,
+                                             size_t& level) {
   size_t max_level = key.size();
 
   uint32_t version;
   InnerNode* first = FindChild(root_, key[0]);
 
 Restart:
-  size_t level = 1;
+  level = 1;
   InnerNode* current = first;
   InnerNode* next_node = nullptr;
 
@@ -363,9 +447,7 @@ LocalRestart:
         goto Restart;
       }
 
-      Rehash(kv_info, key, level);
-      InsertIntoLeaf(current, kv_info, level);
-      return;
+      return current;
     }
 
     if (level == max_level) {
@@ -376,8 +458,9 @@ LocalRestart:
 
       Rehash(kv_info, key, level);
       current->hash_ = kv_info.hash;
-      current->vptr_ = kv_info.vptr;
-      return;
+      UpdateNodeVptr(current, kv_info.vptr, *GetLiveSnapshots());
+      PersistNodeVptr(current, kv_info.vptr);
+      return nullptr;
     }
 
     next_node = FindChild(current, key[level]);
@@ -391,22 +474,16 @@ LocalRestart:
         goto LocalRestart;
       }
 
-      Rehash(kv_info, key, level + 1);
+      // New leaf is returned locked, so records following this one
+      // can be inserted into it together.
       InnerNode* leaf = AllocateLeafNode(level + 1, key[level], nullptr);
-
-      std::lock_guard<OptLock> leaf_lk(leaf->opt_lock_);
-
-      ++leaf->status_;
-      leaf->buffer_[0] = kv_info.hash;
-      leaf->buffer_[1] = kv_info.vptr;
-      leaf->estimated_size_ = kv_info.kv_size;
+      leaf->opt_lock_.lock();
       leaf->parent_node = current;
 
       InsertToArtNode(current, leaf, key[level], true);
       current->opt_lock_.unlock();
-      leaf->heat_group_->UpdateSize(kv_info.kv_size);
-      leaf->heat_group_->UpdateHeat();
-      return;
+      ++level;
+      return leaf;
     }
 
     current = next_node;
@@ -414,8 +491,9 @@ LocalRestart:
   }
 }
 
-bool GlobalMemtable::Get(std::string& key, std::string& value, Status* s) {
-  size_t max_level = key.length();
+bool GlobalMemtable::Get(const Slice& key, PinnableSlice* value, Status* s,
+                         SequenceNumber snapshot, bool verify_checksums) {
+  size_t max_level = key.size();
   size_t level = 1;
   InnerNode* backup_node = nullptr;
   size_t backup_level = 0;
@@ -425,18 +503,18 @@ bool GlobalMemtable::Get(std::string& key, std::string& value, Status* s) {
   bool found = false;
   while (current && !found) {
     if (IS_LEAF(current)) {
-      found = FindKeyInInnerNode(current, level, key, value, s);
+      found = FindKeyInInnerNode(current, level, key, value, s, snapshot,
+                                 verify_checksums);
     } else if (level == max_level) {
       shared_lock<RWSpinLock> read_lk(current->vptr_lock_);
 
       // This mean children of current node are waiting to be reclaimed,
       // so this node becomes a leaf node again.
       if (unlikely(IS_LEAF(current))) {
-        found = FindKeyInInnerNode(current, level, key, value, s);
-      } else if (current->vptr_ > 0) {
-        auto type = vlog_manager_->GetKeyValue(current->vptr_, key, value);
-        *s = type == kTypeValue ? Status::OK() : Status::NotFound();
-        found = true;
+        found = FindKeyInInnerNode(current, level, key, value, s, snapshot,
+                                   verify_checksums);
+      } else if (auto vptr = GetVisibleVptr(current, snapshot)) {
+        found = ReadRecord(vptr, key, value, s, verify_checksums);
       }
 
       break;
@@ -446,7 +524,8 @@ bool GlobalMemtable::Get(std::string& key, std::string& value, Status* s) {
   }
 
   if (!found && backup_node) {
-    found = FindKeyInInnerNode(backup_node, backup_level, key, value, s);
+    found = FindKeyInInnerNode(backup_node, backup_level, key, value, s,
+                               snapshot, verify_checksums);
   }
 
   if (backup_level) {
@@ -465,12 +544,23 @@ bool GlobalMemtable::SqueezeNode(InnerNode* leaf) {
   auto node = leaf->nvm_node_;
   auto data = node->data;
 
+  // Position, insert times and sequence number of the oldest kept version.
+  struct KeptVersion {
+    int pos;
+    int insert_times;
+    SequenceNumber seq;
+  };
+
   // Maybe we can use vector instead of map.
-  std::unordered_map<std::string, std::pair<int, int>> key_set;
+  std::unordered_map<std::string, KeptVersion> key_set;
 
   RecordIndex index;
   std::unordered_map<uint64_t, std::vector<RecordIndex>> unused_indexes;
 
+  // Older versions still visible to a snapshot are kept.
+  auto snapshots = GetLiveSnapshots();
+  bool has_snapshots = !snapshots->empty();
+
   int32_t prev_size = leaf->estimated_size_;
   int32_t cur_size = 0;
   int count = 0, fpos = 0;
@@ -489,35 +579,53 @@ bool GlobalMemtable::SqueezeNode(InnerNode* leaf) {
       continue;
     }
     vlog_manager_->GetKeyIndex(vptr, key, index);
+    SequenceNumber seq = has_snapshots ? vlog_manager_->GetSeqNum(vptr) : 0;
     auto iter = key_set.find(key);
-    if (iter != key_set.end()) {
+    if (iter != key_set.end() &&
+        !(has_snapshots &&
+          IsPinnedBySnapshot(*snapshots, seq, iter->second.seq))) {
       GetActualVptr(vptr);
-      unused_indexes[vptr >> 20].emplace_back(index);
-      iter->second.second += kv_info.insert_times;
+      unused_indexes[vlog_manager_->GetSegmentId(vptr)].emplace_back(index);
+      iter->second.insert_times += kv_info.insert_times;
+      continue;
+    }
+
+    int insert_times = kv_info.insert_times;
+    if (iter != key_set.end()) {
+      UpdateInsertTimes(temp_data[iter->second.pos],
+                        std::min(iter->second.insert_times, 127));
+      iter->second = {count + 1, insert_times, seq};
     } else {
-      int insert_times = kv_info.insert_times;
-      key_set[key] = std::make_pair(count + 1, insert_times);
-      temp_fingerprints[fpos++] = static_cast<uint8_t>(kv_info.actual_hash);
-      temp_data[count++] = kv_info.hash;
-      temp_data[count++] = kv_info.vptr;
-      cur_size += kv_info.kv_size;
+      key_set[key] = {count + 1, insert_times, seq};
     }
+    temp_fingerprints[fpos++] = static_cast<uint8_t>(kv_info.actual_hash);
+    temp_data[count++] = kv_info.hash;
+    temp_data[count++] = kv_info.vptr;
+    cur_size += GetKVSize(kv_info);
   }
 
   // If node is still almost full after squeeze, we split it instead.
-  if (unlikely(key_set.size() >= NVM_MAX_SIZE - 16)) {
+  if (unlikely(fpos >= NVM_MAX_SIZE - 16)) {
     return false;
   }
 
   for (auto& pair : key_set) {
-    auto& pos_and_counts = pair.second;
-    UpdateInsertTimes(temp_data[pos_and_counts.first],
-                      std::min(pos_and_counts.second, 127));
+    auto& version = pair.second;
+    UpdateInsertTimes(temp_data[version.pos],
+                      std::min(version.insert_times, 127));
   }
 
   assert(fpos <= NVM_MAX_SIZE - 16);
   assert(fpos * 2 == count);
 
+  // Kept versions were collected from newest to oldest, reverse them
+  // so that newer records stay at higher positions like appended ones.
+  for (int l = 0, r = fpos - 1; l < r; ++l, --r) {
+    std::swap(temp_fingerprints[l], temp_fingerprints[r]);
+    std::swap(temp_data[l * 2], temp_data[r * 2]);
+    std::swap(temp_data[l * 2 + 1], temp_data[r * 2 + 1]);
+  }
+
   leaf->estimated_size_ = cur_size;
   leaf->squeezed_size_ += (prev_size - cur_size);
   leaf->heat_group_->UpdateSqueezedSize(prev_size - cur_size);
@@ -551,6 +659,7 @@ bool GlobalMemtable::SqueezeNode(InnerNode* leaf) {
 // For level 1, 4, 7..., we read key and modify prefixes in hash.
 int32_t GlobalMemtable::ReadFromVLog(NVMNode* nvm_node, size_t level,
                                   uint64_t& leaf_vptr, uint64_t& leaf_hash,
+                                  autovector<uint64_t>& older_vptrs,
                                   autovector<KVStruct>* split_buckets) {
   int32_t delta = 0;
   int32_t final_size = 0;
@@ -566,8 +675,11 @@ int32_t GlobalMemtable::ReadFromVLog(NVMNode* nvm_node, size_t level,
     vlog_manager_->GetKey(kv_info.actual_vptr, key);
 
     if (key.size() == level) {
-      final_size = kv_info.kv_size;
+      final_size = GetKVSize(kv_info);
       delta += final_size;
+      if (leaf_vptr) {
+        older_vptrs.push_back(leaf_vptr);
+      }
       leaf_vptr = kv_info.vptr;
       leaf_hash = kv_info.hash;
     } else {
@@ -582,6 +694,7 @@ int32_t GlobalMemtable::ReadFromVLog(NVMNode* nvm_node, size_t level,
 
 int32_t GlobalMemtable::ReadFromNVM(NVMNode* nvm_node, size_t level,
                                  uint64_t& leaf_vptr, uint64_t& leaf_hash,
+                                 autovector<uint64_t>& older_vptrs,
                                  autovector<KVStruct>* split_buckets) {
   int32_t delta = 0;
   int32_t final_size = 0;
@@ -594,8 +707,11 @@ int32_t GlobalMemtable::ReadFromNVM(NVMNode* nvm_node, size_t level,
     }
 
     if (kv_info.key_length == level) {
-      final_size = kv_info.kv_size;
+      final_size = GetKVSize(kv_info);
       delta += final_size;
+      if (leaf_vptr) {
+        older_vptrs.push_back(leaf_vptr);
+      }
       leaf_vptr = kv_info.vptr;
       leaf_hash = kv_info.hash;
     } else {
@@ -615,12 +731,15 @@ void GlobalMemtable::SplitLeaf(InnerNode* leaf, size_t level,
 
   uint64_t leaf_vptr = 0;
   uint64_t leaf_hash = 0;
+  autovector<uint64_t> older_vptrs;
   int32_t delta;
   autovector<KVStruct> split_buckets[256];
   if (level % 3 == 0) {
-    delta = ReadFromVLog(old_nvm_node, level, leaf_vptr, leaf_hash, split_buckets);
+    delta = ReadFromVLog(old_nvm_node, level, leaf_vptr, leaf_hash,
+                         older_vptrs, split_buckets);
   } else {
-    delta = ReadFromNVM(old_nvm_node, level, leaf_vptr, leaf_hash, split_buckets);
+    delta = ReadFromNVM(old_nvm_node, level, leaf_vptr, leaf_hash,
+                        older_vptrs, split_buckets);
   }
   leaf->heat_group_->UpdateSize(delta);
 
@@ -672,7 +791,7 @@ void GlobalMemtable::SplitLeaf(InnerNode* leaf, size_t level,
       temp_fingerprints[fpos++] = static_cast<uint8_t>(kv_info.actual_hash);
       temp_data[pos++] = kv_info.hash;
       temp_data[pos++] = kv_info.vptr;
-      new_leaf->estimated_size_ += kv_info.kv_size;
+      new_leaf->estimated_size_ += GetKVSize(kv_info);
 
       bucket = (int)(kv_info.actual_hash & 63);
       h = (int)(kv_info.actual_hash >> 6);
@@ -726,38 +845,62 @@ void GlobalMemtable::SplitLeaf(InnerNode* leaf, size_t level,
     std::lock_guard<RWSpinLock> art_lk(leaf->art_rw_lock_);
     std::lock_guard<RWSpinLock> vptr_lk(leaf->vptr_lock_);
 
+    // Older versions of key equal to prefix are replayed, so the ones
+    // still visible to snapshots are kept in leaf when it's non-leaf.
+    auto snapshots = GetLiveSnapshots();
     leaf->art = art;
-    leaf->vptr_ = leaf_vptr;
+    for (auto vptr : older_vptrs) {
+      UpdateNodeVptr(leaf, vptr, *snapshots);
+    }
+    UpdateNodeVptr(leaf, leaf_vptr, *snapshots);
     leaf->hash_ = leaf_hash;
+    PersistNodeVptr(leaf, leaf_vptr);
     SET_ART_NON_FULL(leaf);
     SET_NON_LEAF(leaf);
   }
 
 }
 
-// This function is responsible for unlocking OptLock
-void GlobalMemtable::InsertIntoLeaf(InnerNode* leaf, KVStruct& kv_info,
-                                    size_t level) {
-  int write_pos = GET_NODE_BUFFER_SIZE(leaf->status_) << 1;
-  leaf->buffer_[write_pos] = kv_info.hash;
-  leaf->buffer_[write_pos + 1] = kv_info.vptr;
-  MEMORY_BARRIER;
-  ++leaf->status_;
-  leaf->estimated_size_ += kv_info.kv_size;
-
-  if (likely(write_pos < 30)) {
-    leaf->opt_lock_.unlock();
-    leaf->heat_group_->UpdateSize(kv_info.kv_size);
-    leaf->heat_group_->UpdateHeat();
-    return;
-  }
+// This function is responsible for unlocking OptLock. If leaf is split,
+// the rest records are left for caller to insert again.
+size_t GlobalMemtable::InsertIntoLeaf(InnerNode* leaf, ArtPutRecord* records,
+                                      size_t count, size_t level) {
+#ifndef ROCKSDB_SUPPORT_THREAD_LOCAL
+  uint64_t staged_rows[NVM_MAX_SIZE * 2];
+#endif
+
+  auto heat_group = leaf->heat_group_;
+  int32_t inserted_size = 0;
+  size_t inserted = 0;
 
-  leaf->heat_group_->UpdateSize(kv_info.kv_size);
-  leaf->heat_group_->UpdateHeat();
+  // Heat is updated once per record as before, size is updated once.
+  auto update_heat = [&]() {
+    heat_group->UpdateSize(inserted_size);
+    for (size_t i = 0; i < inserted; ++i) {
+      heat_group->UpdateHeat();
+    }
+  };
 
   InnerNode* next_to_split = nullptr;
+  bool split = false;
+
+  while (inserted < count) {
+    auto& kv_info = records[inserted].kv_info;
+    Rehash(kv_info, records[inserted].key, level);
+    ++inserted;
+
+    int write_pos = GET_NODE_BUFFER_SIZE(leaf->status_) << 1;
+    leaf->buffer_[write_pos] = kv_info.hash;
+    leaf->buffer_[write_pos + 1] = kv_info.vptr;
+    MEMORY_BARRIER;
+    ++leaf->status_;
+    leaf->estimated_size_ += GetKVSize(kv_info);
+    inserted_size += GetKVSize(kv_info);
+
+    if (likely(write_pos < 30)) {
+      continue;
+    }
 
-  {
     // If we use read lock here, we can do concurrent read but block write,
     // if we use write lock here, we block read but allow concurrent write.
     shared_lock<SharedMutex> read_lk(leaf->share_mutex_);
@@ -767,19 +910,33 @@ void GlobalMemtable::InsertIntoLeaf(InnerNode* leaf, KVStruct& kv_info,
     int rows = GET_ROWS(leaf->nvm_node_->meta.header);
     assert(rows < NVM_MAX_ROWS);
 
-    FlushBuffer(leaf, rows);
+    // Full rows of remaining records are flushed along with buffer,
+    // as long as the node doesn't become full.
+    int extra_rows = std::min(static_cast<int>((count - inserted) / ROW_SIZE),
+                              NVM_MAX_ROWS - 1 - rows);
+    for (int i = 0; i < ROW_TO_SIZE(extra_rows); ++i) {
+      auto& extra_kv = records[inserted].kv_info;
+      Rehash(extra_kv, records[inserted].key, level);
+      ++inserted;
+      staged_rows[i * 2] = extra_kv.hash;
+      staged_rows[i * 2 + 1] = extra_kv.vptr;
+      leaf->estimated_size_ += GetKVSize(extra_kv);
+      inserted_size += GetKVSize(extra_kv);
+    }
+
+    FlushBuffer(leaf, rows, staged_rows, extra_rows);
+    rows += extra_rows;
 
     if (likely(rows < NVM_MAX_ROWS - 1)) {
-      leaf->opt_lock_.unlock();
-      return;
+      continue;
     }
 
     if (EstimateDistinctCount(leaf->hll_) < SQUEEZE_THRESHOLD &&
         SqueezeNode(leaf)) {
-      leaf->opt_lock_.unlock();
-      return;
+      continue;
     }
 
+    update_heat();
     SplitLeaf(leaf, level, &next_to_split);
 
     if (next_to_split) {
@@ -788,71 +945,170 @@ void GlobalMemtable::InsertIntoLeaf(InnerNode* leaf, KVStruct& kv_info,
     }
 
     leaf->opt_lock_.unlock();
+    split = true;
+    break;
   }
 
-  while (next_to_split) {
-    InnerNode* current = next_to_split;
-    SplitLeaf(current, ++level, &next_to_split);
+  if (split) {
+    while (next_to_split) {
+      InnerNode* current = next_to_split;
+      SplitLeaf(current, ++level, &next_to_split);
 
-    if (next_to_split) {
-      next_to_split->opt_lock_.lock();
-      next_to_split->share_mutex_.lock();
+      if (next_to_split) {
+        next_to_split->opt_lock_.lock();
+        next_to_split->share_mutex_.lock();
+      }
+      current->opt_lock_.unlock(false);
+      current->share_mutex_.unlock();
     }
-    current->opt_lock_.unlock(false);
-    current->share_mutex_.unlock();
+    return inserted;
   }
+
+  leaf->opt_lock_.unlock();
+  update_heat();
+  return inserted;
 }
 
-bool GlobalMemtable::ReadInNVMNode(NVMNode* nvm_node, uint64_t hash,
-                                   std::string& key, std::string& value,
-                                   Status* s) {
+static void UnpinVLogValue(void* arg1, void* /*arg2*/) {
+  UnpinIteratorEpoch(reinterpret_cast<uintptr_t>(arg1));
+}
+
+bool GlobalMemtable::ReadRecord(uint64_t vptr, const Slice& key,
+                                PinnableSlice* value, Status* s,
+                                bool verify_checksums) {
   ValueType type;
-  uint64_t vptr;
-  std::string found_key;
+  Slice record_value;
+  if (!vlog_manager_->MatchKey(vptr, key, type, record_value)) {
+    return false;
+  }
 
-  for (size_t i = 0; i < 16; ++i) {
-    if (!nvm_node->temp_buffer[i * 2 + 1]) {
-      break;
+  if (verify_checksums) {
+    auto verify_s = vlog_manager_->VerifyRecord(vptr);
+    if (unlikely(!verify_s.ok())) {
+      *s = verify_s;
+      return true;
     }
+  }
 
-    if (nvm_node->temp_buffer[i * 2] != hash) {
-      continue;
+  if (type == kTypeVLogCompressedValue) {
+    *s = value ? vlog_manager_->UncompressValue(record_value, value->GetSelf())
+               : Status::OK();
+    if (value && s->ok()) {
+      value->PinSelf();
+    }
+    return true;
+  }
+
+  if (type != kTypeValue) {
+    *s = Status::NotFound();
+    return true;
+  }
+
+  // Value is pinned in vlog like records read by iterators, segments
+  // recycled by gc are not reused before it is released.
+  *s = Status::OK();
+  if (value) {
+    auto epoch = PinIteratorEpoch();
+    value->PinSlice(record_value, UnpinVLogValue,
+                    reinterpret_cast<void*>(static_cast<uintptr_t>(epoch)),
+                    nullptr);
+  }
+  return true;
+}
+
+bool GlobalMemtable::IsVisible(uint64_t vptr, SequenceNumber snapshot) {
+  return snapshot == kMaxSequenceNumber ||
+         vlog_manager_->GetSeqNum(vptr) <= snapshot;
+}
+
+uint64_t GlobalMemtable::GetVisibleVptr(InnerNode* node,
+                                        SequenceNumber snapshot) {
+  if (!node->vptr_ || IsVisible(node->vptr_, snapshot)) {
+    return node->vptr_;
+  }
+  for (auto version = node->old_versions_; version;
+       version = version->next) {
+    if (version->seq <= snapshot) {
+      return version->vptr;
     }
+  }
+  return 0;
+}
 
-    type = vlog_manager_->GetKeyValue(
-        nvm_node->temp_buffer[i * 2 + 1], found_key, value);
-    if (found_key == key) {
-      *s = type == kTypeValue ? Status::OK() : Status::NotFound();
+void GlobalMemtable::UpdateNodeVptr(
+    InnerNode* node, uint64_t vptr,
+    const std::vector<SequenceNumber>& snapshots) {
+  if (snapshots.empty() && !node->old_versions_) {
+    node->vptr_ = vptr;
+    return;
+  }
+
+  if (node->vptr_ && !snapshots.empty()) {
+    auto seq = vlog_manager_->GetSeqNum(node->vptr_);
+    auto newer_seq = vlog_manager_->GetSeqNum(vptr);
+    if (IsPinnedBySnapshot(snapshots, seq, newer_seq)) {
+      node->old_versions_ =
+          new NodeVersion{node->vptr_, seq, newer_seq, node->old_versions_};
+    }
+  }
+  node->vptr_ = vptr;
+
+  // Versions beyond MAX_NODE_VERSIONS are dropped even if still pinned,
+  // snapshots reading them fall through to sst.
+  int count = 0;
+  auto link = &node->old_versions_;
+  while (*link) {
+    auto version = *link;
+    if (count < MAX_NODE_VERSIONS &&
+        IsPinnedBySnapshot(snapshots, version->seq, version->newer_seq)) {
+      ++count;
+      link = &version->next;
+    } else {
+      *link = version->next;
+      delete version;
+    }
+  }
+}
+
+bool GlobalMemtable::ReadInNVMNode(NVMNode* nvm_node, uint64_t hash,
+                                   const Slice& key, PinnableSlice* value,
+                                   Status* s, SequenceNumber snapshot,
+                                   bool verify_checksums) {
+  uint64_t vptr;
+
+  // Records are appended, so we search from the newest one.
+  int temp_size = 0;
+  while (temp_size < 16 && nvm_node->temp_buffer[temp_size * 2 + 1]) {
+    ++temp_size;
+  }
+
+  uint32_t hits = ProbeHashes(nvm_node->temp_buffer, temp_size, hash);
+  while (hits) {
+    int i = HighestBit(hits);
+    hits &= ~(1U << i);
+    if (IsVisible(nvm_node->temp_buffer[i * 2 + 1], snapshot) &&
+        ReadRecord(nvm_node->temp_buffer[i * 2 + 1], key, value, s,
+                   verify_checksums)) {
       return true;
     }
   }
 
   auto data = nvm_node->data;
-  auto fingerprints = nvm_node->meta.fingerprints_;
-  int rows = GET_ROWS(nvm_node->meta.header);
-
-  int search_rows = (rows + 1) / 2 - 1;
-  int size = rows * 16;
-  __m256i target = _mm256_set1_epi8((uint8_t)hash);
-
-  for (int row = search_rows; row >= 0; --row) {
-    int base = row << 5;
-    __m256i f = _mm256_loadu_si256(
-        reinterpret_cast<const __m256i *>(fingerprints + base));
-    __m256i r = _mm256_cmpeq_epi8(f, target);
-    auto res = (unsigned int)_mm256_movemask_epi8(r);
-    while (res > 0) {
-      int found = 31 - __builtin_clz(res);
-      res -= (1 << found);
-      int index = found + base;
+  int size = GET_ROWS(nvm_node->meta.header) * 16;
+
+  uint64_t mask[PROBE_MASK_WORDS];
+  ProbeFingerprints(nvm_node->meta.fingerprints_, size, (uint8_t)hash, mask);
+
+  for (int w = PROBE_MASK_WORDS - 1; w >= 0; --w) {
+    auto res = mask[w];
+    while (res) {
+      int found = HighestBit(res);
+      res &= ~(1ULL << found);
+      int index = (w << 6) + found;
       vptr = data[index * 2 + 1];
       GetActualVptr(vptr);
-      if (!vptr || index >= size || data[index * 2] != hash) {
-        continue;
-      }
-      type = vlog_manager_->GetKeyValue(vptr, found_key, value);
-      if (key == found_key) {
-        *s = type == kTypeValue ? Status::OK() : Status::NotFound();
+      if (vptr && data[index * 2] == hash && IsVisible(vptr, snapshot) &&
+          ReadRecord(vptr, key, value, s, verify_checksums)) {
         return true;
       }
     }
@@ -862,27 +1118,23 @@ bool GlobalMemtable::ReadInNVMNode(NVMNode* nvm_node, uint64_t hash,
 }
 
 bool GlobalMemtable::FindKeyInInnerNode(InnerNode* leaf, size_t level,
-                                        std::string& key, std::string& value,
-                                        Status* s) {
+                                        const Slice& key, PinnableSlice* value,
+                                        Status* s, SequenceNumber snapshot,
+                                        bool verify_checksums) {
   shared_lock<SharedMutex> read_lk(leaf->share_mutex_);
 
-  std::string found_key;
-  ValueType type;
-
   uint64_t hash = HashAndPrefix(key, level);
   int pos = GET_NODE_BUFFER_SIZE(leaf->status_);
   auto buffer = leaf->buffer_;
 
-  for (int i = 0; i < pos; ++i) {
+  uint32_t hits = ProbeHashes(buffer, pos, hash);
+  while (hits) {
+    int i = HighestBit(hits);
+    hits &= ~(1U << i);
     auto vptr = buffer[i * 2 + 1];
     GetActualVptr(vptr);
-    if (!vptr || buffer[i * 2] != hash) {
-      continue;
-    }
-    type = vlog_manager_->GetKeyValue(
-        buffer[i * 2 + 1], found_key, value);
-    if (found_key == key) {
-      *s = type == kTypeValue ? Status::OK() : Status::NotFound();
+    if (vptr && IsVisible(vptr, snapshot) &&
+        ReadRecord(vptr, key, value, s, verify_checksums)) {
       return true;
     }
   }
@@ -895,9 +1147,11 @@ bool GlobalMemtable::FindKeyInInnerNode(InnerNode* leaf, size_t level,
     IncrementBackupRead();
   }
 
-  bool found = ReadInNVMNode(nvm_node, hash, key, value, s);
+  bool found = ReadInNVMNode(nvm_node, hash, key, value, s, snapshot,
+                             verify_checksums);
   if (!found && need_search_backup) {
-    found = ReadInNVMNode(backup_nvm_node, hash, key, value, s);
+    found = ReadInNVMNode(backup_nvm_node, hash, key, value, s, snapshot,
+                          verify_checksums);
   }
 
   if (backup_nvm_node) {
@@ -907,6 +1161,284 @@ bool GlobalMemtable::FindKeyInInnerNode(InnerNode* leaf, size_t level,
   return found;
 }
 
+void GlobalMemtable::MultiGet(const ReadOptions& read_options,
+                              MultiGetContext::Range* range,
+                              SequenceNumber snapshot) {
+  bool verify_checksums = read_options.verify_checksums;
+  ArtGetContext contexts[MultiGetContext::MAX_BATCH_SIZE];
+  ArtGetContext* batch[MultiGetContext::MAX_BATCH_SIZE];
+
+  size_t num_keys = 0;
+  for (auto iter = range->begin(); iter != range->end(); ++iter) {
+    auto& ctx = contexts[num_keys++];
+    ctx.key = iter->ukey;
+    ctx.value = iter->value;
+    ctx.s = iter->s;
+    ctx.found = false;
+  }
+
+  // path[l] is the node reached by first l characters of previous key,
+  // keys are sorted, so we can restart descent from the longest common prefix.
+  autovector<InnerNode*, 32> path;
+  path.push_back(root_);
+  Slice* prev_key = nullptr;
+
+  InnerNode* batch_leaf = nullptr;
+  size_t batch_level = 0;
+  size_t batch_size = 0;
+
+  for (size_t i = 0; i < num_keys; ++i) {
+    auto& ctx = contexts[i];
+    auto& key = ctx.key;
+    size_t max_level = key.size();
+    if (unlikely(max_level == 0)) {
+      continue;
+    }
+
+    size_t common = 0;
+    if (prev_key) {
+      size_t limit = std::min(std::min(prev_key->size(), max_level),
+                              path.size() - 1);
+      while (common < limit && (*prev_key)[common] == key[common]) {
+        ++common;
+      }
+    }
+    prev_key = &key;
+
+    size_t level = common;
+    path.resize(level + 1);
+    InnerNode* current = path[level];
+
+    bool fallback = false;
+    while (current) {
+      if (IS_LEAF(current) || level == max_level) {
+        break;
+      }
+
+      // Node is being compacted, we need to search backup art as well.
+      if (level > 0 && unlikely(current->backup_art)) {
+        fallback = true;
+        break;
+      }
+
+      current = FindChild(current, key[level++]);
+      path.push_back(current);
+    }
+
+    // Leaf reused from previous key may have been reclaimed by compaction.
+    if (current && unlikely(IS_INVALID(current->status_))) {
+      fallback = true;
+    }
+
+    if (unlikely(fallback)) {
+      ctx.found = Get(key, ctx.value, ctx.s, snapshot);
+      continue;
+    }
+
+    if (!current) {
+      continue;
+    }
+
+    if (IS_LEAF(current)) {
+      if (current == batch_leaf && level == batch_level) {
+        batch[batch_size++] = &ctx;
+        continue;
+      }
+
+      if (batch_size) {
+        MultiFindKeysInInnerNode(batch_leaf, batch_level, batch, batch_size,
+                                 snapshot, verify_checksums);
+      }
+      batch_leaf = current;
+      batch_level = level;
+      batch[0] = &ctx;
+      batch_size = 1;
+      continue;
+    }
+
+    shared_lock<RWSpinLock> read_lk(current->vptr_lock_);
+    if (unlikely(IS_LEAF(current))) {
+      ctx.found = FindKeyInInnerNode(current, level, key, ctx.value, ctx.s,
+                                     snapshot, verify_checksums);
+    } else if (auto vptr = GetVisibleVptr(current, snapshot)) {
+      ctx.found = ReadRecord(vptr, key, ctx.value, ctx.s, verify_checksums);
+    }
+  }
+
+  if (batch_size) {
+    MultiFindKeysInInnerNode(batch_leaf, batch_level, batch, batch_size,
+                             snapshot, verify_checksums);
+  }
+
+  size_t idx = 0;
+  for (auto iter = range->begin(); iter != range->end(); ++iter, ++idx) {
+    if (!contexts[idx].found) {
+      continue;
+    }
+
+    if (!iter->value->IsPinned()) {
+      iter->value->PinSelf();
+    }
+    range->AddValueSize(iter->value->size());
+    range->MarkKeyDone(iter);
+    if (range->GetValueSize() > read_options.value_size_soft_limit) {
+      // Set all remaining keys in range to Abort
+      for (auto range_iter = range->begin(); range_iter != range->end();
+           ++range_iter) {
+        range->MarkKeyDone(range_iter);
+        *(range_iter->s) = Status::Aborted();
+      }
+      break;
+    }
+  }
+}
+
+size_t GlobalMemtable::MultiFindKeysInInnerNode(InnerNode* leaf, size_t level,
+                                                ArtGetContext** batch,
+                                                size_t count,
+                                                SequenceNumber snapshot,
+                                                bool verify_checksums) {
+  shared_lock<SharedMutex> read_lk(leaf->share_mutex_);
+
+  size_t num_found = 0;
+
+  for (size_t k = 0; k < count; ++k) {
+    batch[k]->hash = HashAndPrefix(batch[k]->key, level);
+  }
+
+  int pos = GET_NODE_BUFFER_SIZE(leaf->status_);
+  auto buffer = leaf->buffer_;
+
+  for (size_t k = 0; k < count; ++k) {
+    auto ctx = batch[k];
+    if (ctx->found) {
+      continue;
+    }
+
+    uint32_t hits = ProbeHashes(buffer, pos, ctx->hash);
+    while (hits) {
+      int i = HighestBit(hits);
+      hits &= ~(1U << i);
+      auto vptr = buffer[i * 2 + 1];
+      GetActualVptr(vptr);
+      if (vptr && IsVisible(vptr, snapshot) &&
+          ReadRecord(vptr, ctx->key, ctx->value, ctx->s, verify_checksums)) {
+        ctx->found = true;
+        ++num_found;
+        break;
+      }
+    }
+  }
+
+  auto nvm_node = leaf->nvm_node_;
+  auto backup_nvm_node = leaf->backup_nvm_node_;
+  bool need_search_backup = backup_nvm_node && backup_nvm_node != nvm_node;
+
+  if (backup_nvm_node) {
+    IncrementBackupRead();
+  }
+
+  if (num_found < count) {
+    num_found += MultiReadInNVMNode(nvm_node, batch, count, snapshot,
+                                    verify_checksums);
+  }
+  if (num_found < count && need_search_backup) {
+    num_found += MultiReadInNVMNode(backup_nvm_node, batch, count, snapshot,
+                                    verify_checksums);
+  }
+
+  if (backup_nvm_node) {
+    ReduceBackupRead();
+  }
+
+  return num_found;
+}
+
+size_t GlobalMemtable::MultiReadInNVMNode(NVMNode* nvm_node,
+                                          ArtGetContext** batch,
+                                          size_t count,
+                                          SequenceNumber snapshot,
+                                          bool verify_checksums) {
+  uint64_t vptr;
+
+  size_t remain = 0;
+  for (size_t k = 0; k < count; ++k) {
+    remain += !batch[k]->found;
+  }
+  size_t num_found = 0;
+
+  int temp_size = 0;
+  while (temp_size < 16 && nvm_node->temp_buffer[temp_size * 2 + 1]) {
+    ++temp_size;
+  }
+
+  for (size_t k = 0; k < count; ++k) {
+    auto ctx = batch[k];
+    if (ctx->found) {
+      continue;
+    }
+
+    uint32_t hits = ProbeHashes(nvm_node->temp_buffer, temp_size, ctx->hash);
+    while (hits) {
+      int i = HighestBit(hits);
+      hits &= ~(1U << i);
+      if (IsVisible(nvm_node->temp_buffer[i * 2 + 1], snapshot) &&
+          ReadRecord(nvm_node->temp_buffer[i * 2 + 1], ctx->key, ctx->value,
+                     ctx->s, verify_checksums)) {
+        ctx->found = true;
+        ++num_found;
+        break;
+      }
+    }
+  }
+
+  if (num_found == remain) {
+    return num_found;
+  }
+
+  // Fingerprints are loaded once for keys still not found.
+  assert(count <= MultiGetContext::MAX_BATCH_SIZE);
+  ArtGetContext* probing[MultiGetContext::MAX_BATCH_SIZE];
+  uint8_t hash8s[MultiGetContext::MAX_BATCH_SIZE];
+  uint64_t masks[MultiGetContext::MAX_BATCH_SIZE][PROBE_MASK_WORDS];
+  int num_probing = 0;
+  for (size_t k = 0; k < count; ++k) {
+    if (!batch[k]->found) {
+      probing[num_probing] = batch[k];
+      hash8s[num_probing++] = (uint8_t)batch[k]->hash;
+    }
+  }
+
+  auto data = nvm_node->data;
+  int size = GET_ROWS(nvm_node->meta.header) * 16;
+  ProbeFingerprintsBatch(nvm_node->meta.fingerprints_, size, hash8s,
+                         num_probing, masks);
+
+  for (int k = 0; k < num_probing; ++k) {
+    auto ctx = probing[k];
+    for (int w = PROBE_MASK_WORDS - 1; w >= 0 && !ctx->found; --w) {
+      auto res = masks[k][w];
+      while (res) {
+        int found = HighestBit(res);
+        res &= ~(1ULL << found);
+        int index = (w << 6) + found;
+        vptr = data[index * 2 + 1];
+        GetActualVptr(vptr);
+        if (vptr && data[index * 2] == ctx->hash &&
+            IsVisible(vptr, snapshot) &&
+            ReadRecord(vptr, ctx->key, ctx->value, ctx->s,
+                       verify_checksums)) {
+          ctx->found = true;
+          ++num_found;
+          break;
+        }
+      }
+    }
+  }
+
+  return num_found;
+}
+
 InnerNode* GlobalMemtable::FindInnerNodeByKey(const Slice& key,
                                               size_t& level,
                                               bool& stored_in_nvm) {
@@ -936,17 +1468,21 @@ struct IteratorKV {
   std::string key;
   std::string value;
   std::string internal_key;
+  uint64_t    seq_num;  // Packed sequence number and type
 
   IteratorKV() = default;
 
   IteratorKV(std::string& key_, std::string& value_, SequenceNumber seq_num_)
-      : key(std::move(key_)), value(std::move(value_)){
+      : key(std::move(key_)), value(std::move(value_)), seq_num(seq_num_) {
     internal_key = key;
     PutFixed64(&internal_key, seq_num_);
   }
 
+  // Versions of the same key are ordered from newest to oldest, so unique
+  // keeps the newest one no matter in which order records are read.
   friend bool operator<(const IteratorKV& l, const IteratorKV& r) {
-    return l.key < r.key;
+    int cmp = l.key.compare(r.key);
+    return cmp < 0 || (cmp == 0 && l.seq_num > r.seq_num);
   }
 
   friend bool operator==(const IteratorKV& l, const IteratorKV& r) {
@@ -956,15 +1492,14 @@ struct IteratorKV {
 
 class GlobalMemTableIterator : public InternalIterator {
  public:
-  GlobalMemTableIterator(GlobalMemtable* mem,
-                         [[maybe_unused]] const ReadOptions& read_options)
-      : mem_(mem), valid_(false) {}
+  GlobalMemTableIterator(GlobalMemtable* mem, const ReadOptions& read_options,
+                         SequenceNumber sequence, uint64_t epoch)
+      : mem_(mem), valid_(false), sequence_(sequence),
+        verify_checksums_(read_options.verify_checksums),
+        epoch_(epoch ? epoch : PinIteratorEpoch()) {}
 
   ~GlobalMemTableIterator() override {
-    if (current_node_) {
-      UnlockNode();
-    }
-    DeleteIterator();
+    UnpinIteratorEpoch(epoch_);
   }
 
   // No copying allowed
@@ -974,109 +1509,66 @@ class GlobalMemTableIterator : public InternalIterator {
   bool Valid() const override { return valid_; }
 
   void Seek(const Slice& key) override {
-    FindKey(ExtractUserKey(key));
-  }
-
-  void FindKey(const Slice& key) {
-    [[maybe_unused]] size_t level;
-    [[maybe_unused]] bool stored_in_nvm;
-
-    while (true) {
-      current_node_ = mem_->FindInnerNodeByKey(key, level, stored_in_nvm);
-      if (unlikely(!current_node_)) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        continue;
-      }
-
-      LockNode();
-      if (likely(IS_LEAF(current_node_))) {
-        break;
-      }
-      UnlockNode();
-    }
-
+    Slice user_key = ExtractUserKey(key);
+    ReleaseNode();
+    current_node_ = FindSeekNode(user_key, true);
     ReadNode();
 
-    IteratorKV expect;
-    expect.key = std::string(key.data(), key.size());
-    index = std::lower_bound(keys_in_node_.begin(), keys_in_node_.end(), expect)
-        - keys_in_node_.begin();
-    if (index == keys_in_node_.size()) {
-      Next();
+    index = std::lower_bound(keys_in_node_.begin(), keys_in_node_.end(),
+                             user_key, KeyLess) - keys_in_node_.begin();
+    if (index < keys_in_node_.size()) {
+      valid_ = true;
+    } else {
+      NextNode();
     }
   }
 
-  void ReadNode() {
-    keys_in_node_.clear();
-    std::string k, v;
-    SequenceNumber seq_num;
-    for (size_t i = 0; i < GET_NODE_BUFFER_SIZE(current_node_->status_); ++i) {
-      auto vptr = current_node_->buffer_[i * 2 + 1];
-      GetActualVptr(vptr);
-      if (!vptr) {
-        continue;
-      }
-      auto type = mem_->vlog_manager_->GetKeyValue(vptr, k, v, seq_num);
-      seq_num = (seq_num << 8) | type;
-      keys_in_node_.emplace_back(k, v, seq_num);
-    }
-    auto nvm_size = GET_SIZE(current_node_->nvm_node_->meta.header);
-    for (size_t i = 0; i < nvm_size; ++i) {
-      auto vptr = current_node_->nvm_node_->data[i * 2 + 1];
-      if (!vptr) {
-        continue;
-      }
-      auto type = mem_->vlog_manager_->GetKeyValue(vptr, k, v, seq_num);
-      seq_num = (seq_num << 8) | type;
-      keys_in_node_.emplace_back(k, v, seq_num);
-    }
-
-    std::stable_sort(keys_in_node_.begin(), keys_in_node_.end());
-    keys_in_node_.erase(
-        std::unique(keys_in_node_.begin(), keys_in_node_.end()),
-        keys_in_node_.end());
-
-    index = 0;
-    valid_ = true;
-  }
+  void SeekForPrev(const Slice& key) override {
+    Slice user_key = ExtractUserKey(key);
+    ReleaseNode();
+    current_node_ = FindSeekNode(user_key, false);
+    ReadNode();
 
-  void SeekForPrev([[maybe_unused]] const Slice& k) override {
-    // Currently SeekForPrev is not implemented.
-    assert(false);
+    index = std::upper_bound(keys_in_node_.begin(), keys_in_node_.end(),
+                             user_key, KeyGreater) - keys_in_node_.begin();
+    if (index > 0) {
+      --index;
+      valid_ = true;
+    } else {
+      PrevNode();
+    }
   }
 
   void SeekToFirst() override {
-    // SeekToFirst is not needed in YCSB. I'm lazy. Zzzzzzzzz.
-    assert(false);
+    ReleaseNode();
+    current_node_ = mem_->root_;
+    ReadNode();
+    index = 0;
+    if (!keys_in_node_.empty()) {
+      valid_ = true;
+    } else {
+      NextNode();
+    }
   }
 
   void SeekToLast() override {
-    assert(false);
+    ReleaseNode();
+    current_node_ = mem_->tail_;
+    ReadNode();
+    if (!keys_in_node_.empty()) {
+      index = keys_in_node_.size() - 1;
+      valid_ = true;
+    } else {
+      PrevNode();
+    }
   }
 
   void Next() override {
-    ++index;
-    if (index < keys_in_node_.size()) {
+    assert(Valid());
+    if (++index < keys_in_node_.size()) {
       return;
     }
-
-    InnerNode* next_node;
-    keys_in_node_.clear();
-    while (keys_in_node_.empty()) {
-      next_node = current_node_->next_node;
-      UnlockNode();
-      current_node_ = next_node;
-
-      if (!current_node_) {
-        valid_ = false;
-        break;
-      }
-
-      LockNode();
-      if (likely(IS_LEAF(current_node_))) {
-        ReadNode();
-      }
-    }
+    NextNode();
   }
 
   bool NextAndGetResult(IterateResult* result) override {
@@ -1091,7 +1583,12 @@ class GlobalMemTableIterator : public InternalIterator {
   }
 
   void Prev() override {
-    assert(false);
+    assert(Valid());
+    if (index > 0) {
+      --index;
+      return;
+    }
+    PrevNode();
   }
 
   Slice key() const override {
@@ -1104,26 +1601,219 @@ class GlobalMemTableIterator : public InternalIterator {
     return keys_in_node_[index].value;
   }
 
-  Status status() const override { return Status::OK(); }
+  Status status() const override { return status_; }
 
  private:
-  void LockNode() {
-    // TODO: use share mutex ?
-    assert(current_node_);
-    current_node_->opt_lock_.lock();
-    current_node_->share_mutex_.lock();
+  static bool KeyLess(const IteratorKV& kv, const Slice& key) {
+    return Slice(kv.key).compare(key) < 0;
+  }
+
+  static bool KeyGreater(const Slice& key, const IteratorKV& kv) {
+    return key.compare(Slice(kv.key)) < 0;
+  }
+
+  // Find the node to start scanning from. Nodes are linked in key order,
+  // a non-leaf node is followed by its children and ends with its support
+  // node, so when the child of key doesn't exist, we start from the
+  // neighbouring child (or the bound of current subtree) instead.
+  InnerNode* FindSeekNode(const Slice& key, bool forward) {
+    InnerNode* current = mem_->root_;
+    size_t level = 0;
+
+    while (NOT_LEAF(current) && level < key.size()) {
+      auto c = static_cast<unsigned char>(key[level]);
+      InnerNode* child = FindChild(current, c);
+      if (child) {
+        current = child;
+        ++level;
+        continue;
+      }
+
+      if (forward) {
+        child = FindNextChild(current, c);
+        return child ? child : current->support_node;
+      }
+
+      child = FindPrevChild(current, c);
+      return child ? child->support_node : current;
+    }
+
+    return current;
+  }
+
+  // Move to the first key of the following non-empty node. Nodes are
+  // not locked between two reads, a node may be split after we read it,
+  // so keys not greater than the last returned key are skipped.
+  void NextNode() {
+    std::string last_key;
+    if (valid_) {
+      last_key = keys_in_node_[index].key;
+    }
+
+    while (true) {
+      current_node_ = current_node_->next_node;
+
+      if (!current_node_) {
+        keys_in_node_.clear();
+        valid_ = false;
+        return;
+      }
+
+      ReadNode();
+      if (valid_) {
+        keys_in_node_.erase(
+            keys_in_node_.begin(),
+            std::upper_bound(keys_in_node_.begin(), keys_in_node_.end(),
+                             Slice(last_key), KeyGreater));
+      }
+      if (!keys_in_node_.empty()) {
+        index = 0;
+        valid_ = true;
+        return;
+      }
+    }
+  }
+
+  // Move to the last key of the preceding non-empty node.
+  void PrevNode() {
+    std::string last_key;
+    if (valid_) {
+      last_key = keys_in_node_[index].key;
+    }
+
+    while (true) {
+      current_node_ = current_node_->prev_node;
+
+      if (!current_node_) {
+        keys_in_node_.clear();
+        valid_ = false;
+        return;
+      }
+
+      ReadNode();
+      if (valid_) {
+        keys_in_node_.erase(
+            std::lower_bound(keys_in_node_.begin(), keys_in_node_.end(),
+                             Slice(last_key), KeyLess),
+            keys_in_node_.end());
+      }
+      if (!keys_in_node_.empty()) {
+        index = keys_in_node_.size() - 1;
+        valid_ = true;
+        return;
+      }
+    }
   }
 
-  void UnlockNode() {
-    assert(current_node_);
-    current_node_->opt_lock_.unlock();
-    current_node_->share_mutex_.unlock();
+  // Collect keys of current node in sorted order. For duplicated keys,
+  // only the newest one is kept, so we read from newest to oldest and
+  // rely on stable sort. Leaves are read under shared lock like Get,
+  // which doesn't block inserts. Nvm nodes detached by compaction after
+  // this iterator was created are also read, because the sst their data
+  // flushed to is not in our version. Non-leaf nodes only hold versions
+  // of the key whose length equals to their prefix length.
+  void ReadNode() {
+    keys_in_node_.clear();
+    auto node = current_node_;
+
+    if (NOT_LEAF(node)) {
+      shared_lock<RWSpinLock> read_lk(node->vptr_lock_);
+      if (node->vptr_) {
+        AddKey(node->vptr_);
+      }
+      for (auto version = node->old_versions_; version;
+           version = version->next) {
+        AddKey(version->vptr);
+      }
+    } else {
+      shared_lock<SharedMutex> read_lk(node->share_mutex_);
+
+      for (int i = GET_NODE_BUFFER_SIZE(node->status_) - 1; i >= 0; --i) {
+        AddKey(node->buffer_[i * 2 + 1]);
+      }
+
+      auto nvm_node = node->nvm_node_;
+      auto backup_nvm_node = node->backup_nvm_node_;
+      ReadNVMNode(nvm_node, false);
+      if (backup_nvm_node && backup_nvm_node != nvm_node) {
+        IncrementBackupRead();
+        ReadNVMNode(backup_nvm_node, true);
+        ReduceBackupRead();
+      }
+    }
+
+    for (auto retired = node->retired_nvm_nodes_;
+         retired && retired->epoch >= epoch_; retired = retired->next) {
+      ReadNVMNode(retired->nvm_node, true);
+    }
+
+    std::sort(keys_in_node_.begin(), keys_in_node_.end());
+    keys_in_node_.erase(
+        std::unique(keys_in_node_.begin(), keys_in_node_.end()),
+        keys_in_node_.end());
+  }
+
+  // Nvm nodes being compacted hold buffer of leaf in temp buffer.
+  void ReadNVMNode(NVMNode* nvm_node, bool read_temp_buffer) {
+    for (int i = GET_SIZE(nvm_node->meta.header) - 1; i >= 0; --i) {
+      AddKey(nvm_node->data[i * 2 + 1]);
+    }
+    if (read_temp_buffer) {
+      for (int i = 15; i >= 0; --i) {
+        AddKey(nvm_node->temp_buffer[i * 2 + 1]);
+      }
+    }
+  }
+
+  void AddKey(uint64_t vptr) {
+    GetActualVptr(vptr);
+    if (!vptr) {
+      return;
+    }
+
+    if (verify_checksums_) {
+      auto s = mem_->vlog_manager_->VerifyRecord(vptr);
+      if (unlikely(!s.ok())) {
+        status_ = s;
+        return;
+      }
+    }
+
+    std::string k, v;
+    SequenceNumber seq_num;
+    ValueType type;
+    auto s = mem_->vlog_manager_->GetKeyValue(vptr, k, v, seq_num, type);
+    if (unlikely(!s.ok())) {
+      status_ = s;
+      return;
+    }
+    if (seq_num > sequence_) {
+      return;
+    }
+    seq_num = (seq_num << 8) | type;
+    keys_in_node_.emplace_back(k, v, seq_num);
+  }
+
+  void ReleaseNode() {
+    current_node_ = nullptr;
+    valid_ = false;
   }
 
   GlobalMemtable* mem_;
 
   bool valid_;
 
+  // Versions newer than sequence are invisible
+  SequenceNumber sequence_;
+
+  bool verify_checksums_;
+
+  // Corruption of records skipped by iterator
+  Status status_;
+
+  // Resources unlinked after this epoch are kept for us
+  uint64_t epoch_;
+
   InnerNode* current_node_ = nullptr;
 
   std::vector<IteratorKV> keys_in_node_;
@@ -1131,8 +1821,10 @@ class GlobalMemTableIterator : public InternalIterator {
   size_t index = 0;
 };
 
-InternalIterator* GlobalMemtable::NewIterator(const ReadOptions& read_options) {
-  return new GlobalMemTableIterator(this, read_options);
+InternalIterator* GlobalMemtable::NewIterator(const ReadOptions& read_options,
+                                              SequenceNumber sequence,
+                                              uint64_t epoch) {
+  return new GlobalMemTableIterator(this, read_options, sequence, epoch);
 }
 
 } // namespace ROCKSDB_NAMESPACE
@@ -9,12 +9,12 @@
 // TODO:
 // 1. keys smaller than 8byte can be directly stored in node
 // 2. store vptr in support node instead of inner node
-// 3. Update hyper log log and fingerprints when doing recovery
 
 #pragma once
 #include <rocksdb/rocksdb_namespace.h>
 #include <rocksdb/slice.h>
 #include "table/internal_iterator.h"
+#include "table/multiget_context.h"
 #include "util/autovector.h"
 #include "util/mutexlock.h"
 
@@ -40,6 +40,23 @@ class VLogManager;
 struct KVStruct;
 class GlobalMemTableIterator;
 
+// Nvm node detached from a leaf by compaction. Data in it has been
+// flushed to sst, but iterators pinned at or before epoch still read it.
+struct RetiredNVMNode {
+  NVMNode*        nvm_node;
+  uint64_t        epoch;
+  RetiredNVMNode* next;
+};
+
+// Older version of the key held by a non-leaf node, kept while a live
+// snapshot in [seq, newer_seq) still sees it.
+struct NodeVersion {
+  uint64_t     vptr;
+  uint64_t     seq;
+  uint64_t     newer_seq;
+  NodeVersion* next;
+};
+
 struct InnerNode {
   uint64_t    buffer_[32];     // 256B buffer
   uint8_t     hll_[64];        // hyper log log use 64 buckets
@@ -54,15 +71,22 @@ struct InnerNode {
   NVMNode*    nvm_node_;
   NVMNode*    backup_nvm_node_;
 
+  // Newest first, see RetiredNVMNode
+  RetiredNVMNode* retired_nvm_nodes_;
+
   // support node is used to simplify insert operation,
   // it itself doesn't store any data.
   InnerNode*  support_node;
   InnerNode*  parent_node;
   InnerNode*  next_node;
+  InnerNode*  prev_node;       // Only used by backward iteration
 
   uint64_t    vptr_;
   uint64_t    hash_;
 
+  // Newest first, protected by vptr_lock_ like vptr_
+  NodeVersion* old_versions_;
+
   SharedMutex share_mutex_; // Used for flush and split operation
   RWSpinLock  art_rw_lock_; // Protect art pointer
   RWSpinLock  link_lock_;   // Protect last child node
@@ -75,6 +99,40 @@ struct InnerNode {
   int64_t     oldest_key_time_;  // Just for compatibility
 
   InnerNode();
+
+  ~InnerNode();
+
+  // Delete old versions, caller holds vptr_lock_ exclusively.
+  void ClearOldVersions();
+};
+
+// Contents of a write batch whose records start at vptr in vlog.
+struct ArtPutBatch {
+  Slice    contents;
+  uint64_t vptr;
+  size_t   count;
+};
+
+struct ArtPutRecord {
+  Slice    key;
+  KVStruct kv_info;
+};
+
+// Lookup state of a single key in GlobalMemtable::MultiGet.
+struct ArtGetContext {
+  Slice          key;
+  PinnableSlice* value;
+  Status*      s;
+  uint64_t     hash;
+  bool         found;
+};
+
+// Non-leaf node found when linking node list in recovery, its art is
+// built afterwards, together with the others.
+struct RecoveredNonLeaf {
+  InnerNode*                 node;
+  std::vector<InnerNode*>    children;
+  std::vector<unsigned char> prefixes;
 };
 
 class GlobalMemtable {
@@ -88,21 +146,52 @@ class GlobalMemtable {
 
   GlobalMemtable(VLogManager* vlog_manager,
                  HeatGroupManager* group_manager,
-                 Env* env, bool recovery = false);
+                 Env* env, bool recovery = false,
+                 int num_recovery_threads = 1);
 
   ~GlobalMemtable();
 
   void Reset();
 
-  void Recovery();
+  // Nodes are restored on num_threads threads, then node list is linked
+  // in one pass over them, and arts of non-leaf nodes are built in parallel.
+  void Recovery(int num_threads);
 
-  InternalIterator* NewIterator(const ReadOptions& read_options);
+  // Iterator only returns versions no newer than sequence. It takes over
+  // epoch pinned by caller before the super version was referenced, so
+  // nodes compacted into ssts missing from that version stay readable;
+  // epoch 0 pins current epoch.
+  InternalIterator* NewIterator(const ReadOptions& read_options,
+                                SequenceNumber sequence = kMaxSequenceNumber,
+                                uint64_t epoch = 0);
 
-  InnerNode* RecoverNonLeaf(InnerNode* parent, int level, HeatGroup*& group);
+  // nodes[pos] is parent, return dummy node of parent with pos pointing
+  // to it.
+  InnerNode* RecoverNonLeaf(std::vector<InnerNode*>& nodes, size_t& pos,
+                            int level, HeatGroup*& group,
+                            std::vector<RecoveredNonLeaf>& non_leaves);
 
   void Put(Slice& slice, uint64_t base_vptr, size_t count);
 
-  bool Get(std::string& key, std::string& value, Status* s);
+  // Insert records of several write batches together. Records are sorted
+  // by key, so the art is descended once for records in the same leaf,
+  // and they are inserted under one lock.
+  void MultiPut(const ArtPutBatch* batches, size_t num_batches);
+
+  // Get the newest version of key whose sequence number is not larger
+  // than snapshot. Value is pinned in vlog instead of being copied.
+  // s is set to Corruption if verify_checksums and record is corrupted.
+  bool Get(const Slice& key, PinnableSlice* value, Status* s,
+           SequenceNumber snapshot = kMaxSequenceNumber,
+           bool verify_checksums = false);
+
+  // Batched version of Get. Keys in range must be sorted, keys sharing
+  // a prefix share the descent of art, and keys falling into the same leaf
+  // are probed together. Found keys are marked done in range,
+  // the others are left for Version::MultiGet.
+  void MultiGet(const ReadOptions& read_options,
+                MultiGetContext::Range* range,
+                SequenceNumber snapshot = kMaxSequenceNumber);
 
   InnerNode* FindInnerNodeByKey(const Slice& key, size_t& level,
                                 bool& stored_in_nvm);
@@ -110,17 +199,50 @@ class GlobalMemtable {
  private:
   friend class Compactor;
 
-  void PutRecover(uint64_t vptr);
-
-  void Put(Slice& key, KVStruct& kv_info);
+  // Return locked leaf that key falls into, a new leaf is created if
+  // needed. Return nullptr if record has been stored in a non-leaf node.
+  InnerNode* FindLeafForInsert(Slice& key, KVStruct& kv_info, size_t& level);
 
   bool FindKeyInInnerNode(InnerNode* leaf, size_t level,
-                          std::string& key, std::string& value, Status* s);
+                          const Slice& key, PinnableSlice* value, Status* s,
+                          SequenceNumber snapshot, bool verify_checksums);
 
   bool ReadInNVMNode(NVMNode* nvm_node, uint64_t hash,
-                     std::string& key, std::string& value, Status* s);
-
-  void InsertIntoLeaf(InnerNode* leaf, KVStruct& kv_info, size_t level);
+                     const Slice& key, PinnableSlice* value, Status* s,
+                     SequenceNumber snapshot, bool verify_checksums);
+
+  // Compare key of record at vptr in place, return false if it differs.
+  // Otherwise set s and pin value to vlog.
+  bool ReadRecord(uint64_t vptr, const Slice& key,
+                  PinnableSlice* value, Status* s, bool verify_checksums);
+
+  bool IsVisible(uint64_t vptr, SequenceNumber snapshot);
+
+  // Newest version of non-leaf node visible to snapshot, 0 if none.
+  // Caller holds vptr_lock_ of node.
+  uint64_t GetVisibleVptr(InnerNode* node, SequenceNumber snapshot);
+
+  // Replace vptr of non-leaf node, caller holds vptr_lock_ exclusively.
+  // Replaced version is kept in old_versions_ if a snapshot sees it,
+  // versions no snapshot sees any more are dropped.
+  void UpdateNodeVptr(InnerNode* node, uint64_t vptr,
+                      const std::vector<SequenceNumber>& snapshots);
+
+  // Probe all keys in batch in a single pass over leaf,
+  // return number of keys found.
+  size_t MultiFindKeysInInnerNode(InnerNode* leaf, size_t level,
+                                  ArtGetContext** batch, size_t count,
+                                  SequenceNumber snapshot,
+                                  bool verify_checksums);
+
+  size_t MultiReadInNVMNode(NVMNode* nvm_node,
+                            ArtGetContext** batch, size_t count,
+                            SequenceNumber snapshot, bool verify_checksums);
+
+  // Return number of records inserted, the rest need to be inserted again
+  // because leaf is split.
+  size_t InsertIntoLeaf(InnerNode* leaf, ArtPutRecord* records, size_t count,
+                        size_t level);
 
   // Try to squeeze node, return false if distinct count exceed limit
   bool SqueezeNode(InnerNode* leaf);
@@ -129,12 +251,16 @@ class GlobalMemtable {
   void SplitLeaf(InnerNode* leaf, size_t level,
                  InnerNode** node_need_split);
 
+  // Records whose key equals prefix of leaf stay in leaf after split,
+  // leaf_vptr is the newest one and older_vptrs the others, oldest first.
   int32_t ReadFromNVM(NVMNode* nvm_node, size_t level,
                       uint64_t& leaf_vptr, uint64_t& leaf_hash,
+                      autovector<uint64_t>& older_vptrs,
                       autovector<KVStruct>* data);
 
   int32_t ReadFromVLog(NVMNode* nvm_node, size_t level,
                        uint64_t& leaf_vptr, uint64_t& leaf_hash,
+                       autovector<uint64_t>& older_vptrs,
                        autovector<KVStruct>* data);
 
   InnerNode* root_;
@@ -245,13 +245,14 @@ void HeatGroupManager::Reset() {
 void HeatGroupManager::BGWork() {
   Compactor* compactor = nullptr;
   while (!thread_stop_) {
-    if (group_operations_.size() == 0) {
+    // Timeout only bounds the delay of stopping thread
+    GroupOperation operation;
+    if (!group_operations_.pop_front_for(operation,
+                                         std::chrono::milliseconds(100))) {
       // TryMergeBaseLayerGroups();
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
       continue;
     }
 
-    auto operation = group_operations_.pop_front();
     if (unlikely(operation.target && operation.target->is_removed)) {
       continue;
     }
@@ -347,6 +348,7 @@ bool HeatGroupManager::MergeNextGroup(HeatGroup* group, HeatGroup* next_group) {
   assert(node_after_start->heat_group_ == next_group);
 
   last_node->next_node = node_after_start;
+  node_after_start->prev_node = last_node;
   auto next_nvm_node = GetNodeAllocator()->relative(node_after_start->nvm_node_);
   if (GET_TAG(last_node->nvm_node_->meta.header, ALT_FIRST_TAG)) {
     last_node->nvm_node_->meta.next1 = next_nvm_node;
@@ -378,7 +380,7 @@ bool HeatGroupManager::MergeNextGroup(HeatGroup* group, HeatGroup* next_group) {
 
   // Free dummy node
   GetNodeAllocator()->DeallocateNode(next_start_node->nvm_node_);
-  delete next_start_node;
+  RetireInnerNode(next_start_node);
   return true;
 }
 
@@ -165,6 +165,9 @@ inline float GetDecayFactor(int delta) {
 // Choose new level of heat group by estimated upper and lower bound.
 int ChooseGroupLevel(HeatGroup* group);
 
+// Level of heat group only by its heat, 0 is the coldest.
+int ChooseGroupLevelByHeat(HeatGroup* group);
+
 // Insert new nodes to heat group of previous node.
 void InsertNodesToGroup(InnerNode* node, InnerNode* inserts);
 
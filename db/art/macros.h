@@ -8,6 +8,8 @@
 
 #ifdef USE_PMEM
 #include <libpmem.h>
+#else
+#include "nvm_emulator.h"
 #endif
 
 namespace ROCKSDB_NAMESPACE {
@@ -32,6 +34,9 @@ namespace ROCKSDB_NAMESPACE {
 #define NVM_MAX_ROWS         14
 #define NVM_MAX_SIZE         224
 #define BULK_WRITE_SIZE      208
+// Older versions kept by a non-leaf node, they fit in buffer together
+// with its vptr when it becomes a leaf again.
+#define MAX_NODE_VERSIONS    15
 
 #define INITIAL_STATUS(s)         (0x80000000 | (s))
 
@@ -117,12 +122,16 @@ namespace ROCKSDB_NAMESPACE {
 
 #define MEMORY_BARRIER __asm__ volatile("mfence":::"memory")
 
+// Without USE_PMEM, nvm is emulated with dram, see nvm_emulator.h
 #ifndef USE_PMEM
-#define MEMCPY(des, src, size, flag) memcpy((des), (src), (size))
-#define PERSIST(ptr, len)
-#define FLUSH(addr, len)
-#define NVM_BARRIER
+#define MEMCPY(des, src, size, flags) \
+  EmulatedMemcpy((des), (src), (size), (flags))
+#define PERSIST(addr, len) \
+  do { EmulatedFlush((addr), (len)); EmulatedFence(); } while (0)
+#define FLUSH(addr, len) EmulatedFlush((addr), (len))
+#define NVM_BARRIER EmulatedFence()
 #define CLWB(ptr, len)
+#define NVM_READ(addr, len) EmulatedRead((addr), (len))
 #else
 #define MEMCPY(des, src, size, flags) \
   pmem_memcpy((des), (src), (size), flags)
@@ -131,6 +140,7 @@ namespace ROCKSDB_NAMESPACE {
 #define FLUSH(addr, len) pmem_flush(addr, len)
 #define NVM_BARRIER pmem_drain()
 #define CLWB(ptr, len)
+#define NVM_READ(addr, len)
 #endif
 
 }  // namespace ROCKSDB_NAMESPACE
\ No newline at end of file
@@ -43,6 +43,7 @@ NodeAllocator::NodeAllocator(const DBOptions& options, bool recovery)
   if (recovery) {
     auto cur_node = (NVMNode*)pmemptr_;
     non_free_pages[0] = 1;
+    recovered_nodes_.push_back(cur_node);
     while (true) {
       int64_t next_offset =
           GET_TAG(cur_node->meta.header, ALT_FIRST_TAG)
@@ -53,6 +54,7 @@ NodeAllocator::NodeAllocator(const DBOptions& options, bool recovery)
       }
 
       non_free_pages[next_offset / PAGE_SIZE] = 1;
+      recovered_nodes_.push_back(cur_node);
     }
   }
 
@@ -67,6 +69,11 @@ NodeAllocator::NodeAllocator(const DBOptions& options, bool recovery)
   delete[] non_free_pages;
 }
 
+void NodeAllocator::TakeRecoveredNodes(std::vector<NVMNode*>& nodes) {
+  nodes.swap(recovered_nodes_);
+  std::vector<NVMNode*>().swap(recovered_nodes_);
+}
+
 void NodeAllocator::Reset() {
   waiting_nodes_.clear();
   free_nodes_.clear();
@@ -85,8 +92,8 @@ NVMNode* NodeAllocator::AllocateNode() {
   return nvm_node;
 }
 
-void NodeAllocator::FreeNodes() {
-  auto size = waiting_nodes_.size();
+void NodeAllocator::FreeNodes(size_t count) {
+  auto size = std::min(count, waiting_nodes_.size());
   while (size--) {
     free_nodes_.emplace_back(waiting_nodes_.pop_front());
   }
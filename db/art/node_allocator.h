@@ -4,6 +4,7 @@
 
 #pragma once
 #include <atomic>
+#include <vector>
 #include <rocksdb/rocksdb_namespace.h>
 #include <rocksdb/slice.h>
 #include "macros.h"
@@ -22,15 +23,24 @@ class NodeAllocator {
 
   NVMNode* GetHead();
 
+  // Nodes in the order of node list, collected when free pages are
+  // rebuilt on recovery, so that the list is walked only once.
+  void TakeRecoveredNodes(std::vector<NVMNode*>& nodes);
+
   size_t GetNumFreePages() {
     return free_nodes_.size();
   }
 
   NVMNode* AllocateNode();
 
+  size_t GetNumWaitingNodes() {
+    return waiting_nodes_.size();
+  }
+
   void DeallocateNode(NVMNode* node);
 
-  void FreeNodes();
+  // Recycle the oldest count deallocated nodes
+  void FreeNodes(size_t count);
 
   int64_t relative(NVMNode* node);
 
@@ -43,6 +53,8 @@ class NodeAllocator {
 
   std::atomic<int> num_free_;
 
+  std::vector<NVMNode*> recovered_nodes_;
+
   TQueueConcurrent<char*> waiting_nodes_;
 
   TQueueConcurrent<char*> free_nodes_;
@@ -0,0 +1,114 @@
+//
+// Latency of a write is paid by the fence after it, as fence of real nvm
+// waits for flushed lines to reach media. Bandwidth is shared by all
+// threads, each write reserves its transfer time in a global timeline.
+//
+
+#include "nvm_emulator.h"
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <rocksdb/options.h>
+#include "port/port.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+struct NVMEmulatorConfig {
+  uint64_t read_latency_ns = 0;
+  uint64_t write_latency_ns = 0;
+  // Bytes per second, 0 means unlimited
+  uint64_t write_bandwidth = 0;
+};
+
+static NVMEmulatorConfig config;
+
+static std::atomic<uint64_t> next_free_ns{0};
+
+static std::atomic<uint64_t> num_flushes{0};
+static std::atomic<uint64_t> num_fences{0};
+static std::atomic<uint64_t> num_reads{0};
+static std::atomic<uint64_t> bytes_written{0};
+
+// Lines flushed by this thread since last fence
+static thread_local bool has_pending_flush = false;
+
+static uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void SpinUntil(uint64_t deadline) {
+  while (NowNanos() < deadline) {
+    port::AsmVolatilePause();
+  }
+}
+
+static void ThrottleWrite(size_t size) {
+  bytes_written.fetch_add(size, std::memory_order_relaxed);
+  if (!config.write_bandwidth) {
+    return;
+  }
+
+  uint64_t cost = size * 1000000000ULL / config.write_bandwidth;
+  uint64_t now = NowNanos();
+  uint64_t prev = next_free_ns.load(std::memory_order_relaxed);
+  uint64_t begin;
+  do {
+    begin = std::max(prev, now);
+  } while (!next_free_ns.compare_exchange_weak(prev, begin + cost,
+                                               std::memory_order_relaxed));
+  SpinUntil(begin + cost);
+}
+
+void InitNVMEmulator(const DBOptions& options) {
+  config.read_latency_ns = options.nvm_emu_read_latency_ns;
+  config.write_latency_ns = options.nvm_emu_write_latency_ns;
+  config.write_bandwidth = options.nvm_emu_write_bandwidth_mb << 20;
+}
+
+void EmulatedMemcpy(void* dest, const void* src, size_t size,
+                    unsigned flags) {
+  memcpy(dest, src, size);
+  EmulatedFlush(dest, size);
+  if (!(flags & PMEM_F_MEM_NODRAIN)) {
+    EmulatedFence();
+  }
+}
+
+void EmulatedFlush(const void* addr, size_t len) {
+  auto begin = reinterpret_cast<uintptr_t>(addr) & ~(uintptr_t)63;
+  auto end = reinterpret_cast<uintptr_t>(addr) + len;
+  size_t lines = (end - begin + 63) >> 6;
+  num_flushes.fetch_add(lines, std::memory_order_relaxed);
+  ThrottleWrite(lines << 6);
+  has_pending_flush = true;
+}
+
+void EmulatedFence() {
+  num_fences.fetch_add(1, std::memory_order_relaxed);
+  if (has_pending_flush && config.write_latency_ns) {
+    SpinUntil(NowNanos() + config.write_latency_ns);
+  }
+  has_pending_flush = false;
+}
+
+void EmulatedRead(const void* /*addr*/, size_t /*len*/) {
+  num_reads.fetch_add(1, std::memory_order_relaxed);
+  if (config.read_latency_ns) {
+    SpinUntil(NowNanos() + config.read_latency_ns);
+  }
+}
+
+std::string NVMEmulatorStats() {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "nvm emulator: flushed lines = %" PRIu64 ", fences = %" PRIu64
+           ", reads = %" PRIu64 ", written bytes = %" PRIu64 "\n",
+           num_flushes.load(), num_fences.load(),
+           num_reads.load(), bytes_written.load());
+  return buf;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,40 @@
+//
+// Emulated nvm device, used when built without USE_PMEM. Nvm file lives
+// in dram (tmpfs, or CXL memory exposed as a NUMA node, see
+// DBOptions::nvm_numa_node), and persistence macros in macros.h are routed
+// here, so that costs of persistence are injected and counted.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <rocksdb/rocksdb_namespace.h>
+
+// Flags of pmem_memcpy used by MEMCPY
+#ifndef PMEM_F_MEM_NODRAIN
+#define PMEM_F_MEM_NODRAIN      (1U << 0)
+#define PMEM_F_MEM_NONTEMPORAL  (1U << 1)
+#endif
+
+namespace ROCKSDB_NAMESPACE {
+
+struct DBOptions;
+
+void InitNVMEmulator(const DBOptions& options);
+
+// Like pmem_memcpy, data is flushed, and fenced unless PMEM_F_MEM_NODRAIN.
+void EmulatedMemcpy(void* dest, const void* src, size_t size, unsigned flags);
+
+// Write back [addr, addr + len), it is durable after next fence.
+void EmulatedFlush(const void* addr, size_t len);
+
+// Wait for writes flushed by this thread.
+void EmulatedFence();
+
+void EmulatedRead(const void* addr, size_t len);
+
+std::string NVMEmulatorStats();
+
+}  // namespace ROCKSDB_NAMESPACE
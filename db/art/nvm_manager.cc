@@ -8,7 +8,14 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <cerrno>
+#include <cstring>
 
+#ifdef NUMA
+#include <numa.h>
+#endif
+
+#include <rocksdb/options.h>
 #include "utils.h"
 
 char* base_memptr = nullptr;
@@ -21,53 +28,106 @@ std::unordered_map<std::string, char*> memories;
 
 namespace ROCKSDB_NAMESPACE {
 
-bool InitializeMemory(std::unordered_map<std::string, int64_t>& memory_usages,
-                      const std::string& nvm_path) {
+// Reserve address range first, so that file can be mapped at an address
+// aligned to page_size. Return nullptr and keep errno on failure.
+static char* MapAligned(int fd, size_t size, size_t page_size) {
+  auto reserved = (char*)mmap(nullptr, size + page_size, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                              -1, 0);
+  if (reserved == MAP_FAILED) {
+    return nullptr;
+  }
+  auto aligned = reinterpret_cast<char*>(
+      ALIGN_UP(reinterpret_cast<size_t>(reserved), page_size));
+
+  void* mapped = MAP_FAILED;
+#if defined(USE_PMEM) && defined(MAP_SYNC)
+  // Stores reach media once flushed, without msync.
+  mapped = mmap(aligned, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED_VALIDATE | MAP_SYNC | MAP_FIXED, fd, 0);
+#endif
+  if (mapped == MAP_FAILED) {
+    mapped = mmap(aligned, size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_FIXED, fd, 0);
+  }
+  if (mapped == MAP_FAILED) {
+    int err = errno;
+    munmap(reserved, size + page_size);
+    errno = err;
+    return nullptr;
+  }
+  assert(mapped == aligned);
+
+  if (aligned > reserved) {
+    munmap(reserved, aligned - reserved);
+  }
+  munmap(aligned + size, reserved + page_size - aligned);
+  return aligned;
+}
+
+// Write every page, pages are placed by memory policy set before. A read
+// would only map shared pages read-only (or the zero page for holes), and
+// first writes still fault. Nothing else runs yet, so writing back the
+// byte read is safe.
+static void PrefaultMemory(char* addr, size_t len) {
+  auto bytes = reinterpret_cast<volatile char*>(addr);
+  for (size_t offset = 0; offset < len; offset += 4096) {
+    bytes[offset] = bytes[offset];
+  }
+}
+
+Status InitializeMemory(std::unordered_map<std::string, int64_t>& memory_usages,
+                        const DBOptions& options, bool* file_exist) {
+  const std::string& nvm_path = options.nvm_path;
   TotalSize = 4096; // used for alignment
   for (auto& memory_usage : memory_usages) {
     TotalSize += memory_usage.second;
   }
 
-#ifdef USE_PMEM
-  int fd;
-
   struct stat buffer;
-  bool file_exist = stat(nvm_path.c_str(), &buffer) == 0;
-  if (!file_exist) {
-    fd = open(nvm_path.c_str(), O_CREAT|O_RDWR, 0666);
-    assert(-1 != fd);
+  *file_exist = stat(nvm_path.c_str(), &buffer) == 0;
+  int fd = open(nvm_path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd == -1) {
+    return Status::IOError("While open nvm file " + nvm_path,
+                           strerror(errno));
+  }
+  if (!*file_exist) {
     posix_fallocate(fd, 0, TotalSize);
-  } else {
-    fd = open(nvm_path.c_str(), O_CREAT, 0666);
-    assert(-1 != fd);
   }
 
-  int is_pmem;
-  size_t mapped_len;
-  base_memptr = (char*)pmem_map_file(
-      nvm_path.c_str(), TotalSize, PMEM_FILE_CREATE, 0666, &mapped_len, &is_pmem);
-  //assert(is_pmem && mapped_len == (size_t)TotalSize);
+  size_t page_size = std::max<size_t>(options.nvm_page_size, 4096);
+  assert((page_size & (page_size - 1)) == 0);
+  base_memptr = MapAligned(fd, TotalSize, page_size);
+  if (base_memptr == nullptr) {
+    Status s = Status::IOError("While mmap nvm file " + nvm_path,
+                               strerror(errno));
+    close(fd);
+    return s;
+  }
   aligned_ptr = reinterpret_cast<char*>(ALIGN_UP(reinterpret_cast<size_t>(base_memptr), 256));
-
   close(fd);
-#else
-  int fd;
 
-  struct stat buffer;
-  bool file_exist = stat(nvm_path.c_str(), &buffer) == 0;
-  if (!file_exist) {
-    fd = open(nvm_path.c_str(), O_RDWR|O_CREAT, 00777);
-    assert(-1 != fd);
-    lseek(fd, TotalSize - 1, SEEK_SET);
-    write(fd, "", 1);
-  } else {
-    fd = open(nvm_path.c_str(), O_RDWR, 00777);
+#ifndef USE_PMEM
+  if (page_size > 4096) {
+    madvise(base_memptr, TotalSize, MADV_HUGEPAGE);
   }
+#endif
 
-  base_memptr = (char*)mmap(
-      nullptr, TotalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  aligned_ptr = reinterpret_cast<char*>(ALIGN_UP(reinterpret_cast<size_t>(base_memptr), 256));
-  close(fd);
+  // Most accesses are point lookups, scans advise their ranges themselves.
+  madvise(base_memptr, TotalSize, MADV_RANDOM);
+
+#ifdef NUMA
+  if (options.nvm_numa_node >= 0 && numa_available() >= 0) {
+    numa_tonode_memory(base_memptr, TotalSize, options.nvm_numa_node);
+  }
+#endif
+
+  if (options.nvm_populate) {
+    PrefaultMemory(base_memptr, TotalSize);
+  }
+
+#ifndef USE_PMEM
+  InitNVMEmulator(options);
 #endif
 
   printf("mmap: %p, %p\n", base_memptr, aligned_ptr);
@@ -78,19 +138,28 @@ bool InitializeMemory(std::unordered_map<std::string, int64_t>& memory_usages,
     offset += memory_usage.second;
   }
 
-  return file_exist;
+  return Status::OK();
 }
 
 char* GetMappedAddress(const std::string& name) {
   return memories[name];
 }
 
+void AdviseMemory(char* addr, size_t len, int advice) {
+  // madvise requires address aligned to page
+  auto begin = reinterpret_cast<char*>(
+      reinterpret_cast<size_t>(addr) & ~(size_t)4095);
+  madvise(begin, len + (addr - begin), advice);
+}
+
 void UnmapMemory() {
-#ifdef USE_PMEM
-  pmem_unmap(base_memptr, TotalSize);
-#else
-  munmap(base_memptr, TotalSize);
+#ifndef USE_PMEM
+  printf("%s", NVMEmulatorStats().c_str());
 #endif
+  if (base_memptr != nullptr) {
+    munmap(base_memptr, TotalSize);
+    base_memptr = nullptr;
+  }
 }
 
 } // namespace ROCKSDB_NAMESPACE
@@ -6,14 +6,23 @@
 #include <string>
 #include <unordered_map>
 #include <rocksdb/rocksdb_namespace.h>
+#include <rocksdb/status.h>
 
 namespace ROCKSDB_NAMESPACE {
 
-bool InitializeMemory(std::unordered_map<std::string, int64_t>& memory_usages,
-                      const std::string& nvm_path);
+struct DBOptions;
+
+// Map nvm file of options.nvm_path and divide it into regions,
+// file_exist is set if file exists before.
+Status InitializeMemory(std::unordered_map<std::string, int64_t>& memory_usages,
+                        const DBOptions& options, bool* file_exist);
 
 char* GetMappedAddress(const std::string& name);
 
+// Tell kernel how [addr, addr + len) is going to be accessed,
+// advice is one of MADV_* for madvise.
+void AdviseMemory(char* addr, size_t len, int advice);
+
 void UnmapMemory();
 
 } // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,322 @@
+//
+// Probe kernels for fingerprints in nvm node and hashes in buffers.
+//
+
+#include "simd_probe.h"
+
+#include <cassert>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ART_PROBE_X86
+#endif
+
+namespace ROCKSDB_NAMESPACE {
+
+// Keep bits at even positions and pack them into low 16 bits.
+static inline uint32_t CompressEvenBits(uint32_t x) {
+  x &= 0x55555555;
+  x = (x | (x >> 1)) & 0x33333333;
+  x = (x | (x >> 2)) & 0x0f0f0f0f;
+  x = (x | (x >> 4)) & 0x00ff00ff;
+  x = (x | (x >> 8)) & 0x0000ffff;
+  return x;
+}
+
+static inline uint32_t CountMask(int count) {
+  return count >= 16 ? 0xffff : (1U << count) - 1;
+}
+
+static inline void ProbeFingerprintsTail(const uint8_t* fingerprints,
+                                         int begin, int size, uint8_t hash8,
+                                         uint64_t* mask) {
+  for (int i = begin; i < size; ++i) {
+    if (fingerprints[i] == hash8) {
+      mask[i >> 6] |= 1ULL << (i & 63);
+    }
+  }
+}
+
+static void ProbeFingerprintsScalar(const uint8_t* fingerprints, int size,
+                                    uint8_t hash8, uint64_t* mask) {
+  memset(mask, 0, sizeof(uint64_t) * PROBE_MASK_WORDS);
+  ProbeFingerprintsTail(fingerprints, 0, size, hash8, mask);
+}
+
+static void ClearMasks(int num_hashes, uint64_t (*masks)[PROBE_MASK_WORDS]) {
+  memset(masks, 0, sizeof(uint64_t) * PROBE_MASK_WORDS * num_hashes);
+}
+
+static void ProbeFingerprintsBatchScalar(
+    const uint8_t* fingerprints, int size, const uint8_t* hash8s,
+    int num_hashes, uint64_t (*masks)[PROBE_MASK_WORDS]) {
+  ClearMasks(num_hashes, masks);
+  for (int k = 0; k < num_hashes; ++k) {
+    ProbeFingerprintsTail(fingerprints, 0, size, hash8s[k], masks[k]);
+  }
+}
+
+static uint32_t ProbeHashesScalar(const uint64_t* pairs, int count,
+                                  uint64_t hash) {
+  uint32_t res = 0;
+  for (int i = 0; i < count; ++i) {
+    res |= static_cast<uint32_t>(pairs[i * 2] == hash) << i;
+  }
+  return res;
+}
+
+#ifdef ART_PROBE_X86
+
+__attribute__((target("sse4.2")))
+static void ProbeFingerprintsSSE42(const uint8_t* fingerprints, int size,
+                                   uint8_t hash8, uint64_t* mask) {
+  memset(mask, 0, sizeof(uint64_t) * PROBE_MASK_WORDS);
+  __m128i target = _mm_set1_epi8(static_cast<char>(hash8));
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i f = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(fingerprints + i));
+    auto res = static_cast<uint64_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(f, target)));
+    mask[i >> 6] |= res << (i & 63);
+  }
+  ProbeFingerprintsTail(fingerprints, i, size, hash8, mask);
+}
+
+__attribute__((target("sse4.2")))
+static void ProbeFingerprintsBatchSSE42(
+    const uint8_t* fingerprints, int size, const uint8_t* hash8s,
+    int num_hashes, uint64_t (*masks)[PROBE_MASK_WORDS]) {
+  ClearMasks(num_hashes, masks);
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i f = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(fingerprints + i));
+    for (int k = 0; k < num_hashes; ++k) {
+      __m128i target = _mm_set1_epi8(static_cast<char>(hash8s[k]));
+      auto res = static_cast<uint64_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(f, target)));
+      masks[k][i >> 6] |= res << (i & 63);
+    }
+  }
+  for (int k = 0; k < num_hashes; ++k) {
+    ProbeFingerprintsTail(fingerprints, i, size, hash8s[k], masks[k]);
+  }
+}
+
+// Hashes of two adjacent pairs are packed into one register.
+__attribute__((target("sse4.2")))
+static uint32_t ProbeHashesSSE42(const uint64_t* pairs, int count,
+                                 uint64_t hash) {
+  __m128i target = _mm_set1_epi64x(static_cast<int64_t>(hash));
+  uint32_t res = 0;
+  for (int i = 0; i < 8; ++i) {
+    __m128i h = _mm_unpacklo_epi64(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pairs + i * 4)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pairs + i * 4 + 2)));
+    __m128i r = _mm_cmpeq_epi64(h, target);
+    res |= static_cast<uint32_t>(
+        _mm_movemask_pd(_mm_castsi128_pd(r))) << (i * 2);
+  }
+  return res & CountMask(count);
+}
+
+__attribute__((target("avx2")))
+static void ProbeFingerprintsAVX2(const uint8_t* fingerprints, int size,
+                                  uint8_t hash8, uint64_t* mask) {
+  memset(mask, 0, sizeof(uint64_t) * PROBE_MASK_WORDS);
+  __m256i target = _mm256_set1_epi8(static_cast<char>(hash8));
+  int i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i f = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(fingerprints + i));
+    auto res = static_cast<uint64_t>(static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(f, target))));
+    mask[i >> 6] |= res << (i & 63);
+  }
+  if (i + 16 <= size) {
+    __m128i f = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(fingerprints + i));
+    auto res = static_cast<uint64_t>(_mm_movemask_epi8(
+        _mm_cmpeq_epi8(f, _mm256_castsi256_si128(target))));
+    mask[i >> 6] |= res << (i & 63);
+    i += 16;
+  }
+  ProbeFingerprintsTail(fingerprints, i, size, hash8, mask);
+}
+
+__attribute__((target("avx2")))
+static void ProbeFingerprintsBatchAVX2(
+    const uint8_t* fingerprints, int size, const uint8_t* hash8s,
+    int num_hashes, uint64_t (*masks)[PROBE_MASK_WORDS]) {
+  ClearMasks(num_hashes, masks);
+  int i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i f = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(fingerprints + i));
+    for (int k = 0; k < num_hashes; ++k) {
+      __m256i target = _mm256_set1_epi8(static_cast<char>(hash8s[k]));
+      auto res = static_cast<uint64_t>(static_cast<uint32_t>(
+          _mm256_movemask_epi8(_mm256_cmpeq_epi8(f, target))));
+      masks[k][i >> 6] |= res << (i & 63);
+    }
+  }
+  if (i + 16 <= size) {
+    __m128i f = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(fingerprints + i));
+    for (int k = 0; k < num_hashes; ++k) {
+      __m128i target = _mm_set1_epi8(static_cast<char>(hash8s[k]));
+      auto res = static_cast<uint64_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(f, target)));
+      masks[k][i >> 6] |= res << (i & 63);
+    }
+    i += 16;
+  }
+  for (int k = 0; k < num_hashes; ++k) {
+    ProbeFingerprintsTail(fingerprints, i, size, hash8s[k], masks[k]);
+  }
+}
+
+__attribute__((target("avx2")))
+static uint32_t ProbeHashesAVX2(const uint64_t* pairs, int count,
+                                uint64_t hash) {
+  __m256i target = _mm256_set1_epi64x(static_cast<int64_t>(hash));
+  uint32_t raw = 0;
+  for (int i = 0; i < 8; ++i) {
+    __m256i r = _mm256_cmpeq_epi64(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pairs + i * 4)),
+        target);
+    raw |= static_cast<uint32_t>(
+        _mm256_movemask_pd(_mm256_castsi256_pd(r))) << (i * 4);
+  }
+  return CompressEvenBits(raw) & CountMask(count);
+}
+
+// Masked loads never touch fingerprints beyond size, so all 224
+// fingerprints are compared in 4 instructions.
+__attribute__((target("avx512f,avx512bw")))
+static void ProbeFingerprintsAVX512(const uint8_t* fingerprints, int size,
+                                    uint8_t hash8, uint64_t* mask) {
+  __m512i target = _mm512_set1_epi8(static_cast<char>(hash8));
+  for (int w = 0; w < PROBE_MASK_WORDS; ++w) {
+    int remain = size - (w << 6);
+    if (remain <= 0) {
+      mask[w] = 0;
+      continue;
+    }
+    __mmask64 load_mask = remain >= 64 ? ~0ULL : (1ULL << remain) - 1;
+    __m512i f = _mm512_maskz_loadu_epi8(load_mask, fingerprints + (w << 6));
+    mask[w] = _mm512_mask_cmpeq_epi8_mask(load_mask, f, target);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void ProbeFingerprintsBatchAVX512(
+    const uint8_t* fingerprints, int size, const uint8_t* hash8s,
+    int num_hashes, uint64_t (*masks)[PROBE_MASK_WORDS]) {
+  for (int w = 0; w < PROBE_MASK_WORDS; ++w) {
+    int remain = size - (w << 6);
+    if (remain <= 0) {
+      for (int k = 0; k < num_hashes; ++k) {
+        masks[k][w] = 0;
+      }
+      continue;
+    }
+    __mmask64 load_mask = remain >= 64 ? ~0ULL : (1ULL << remain) - 1;
+    __m512i f = _mm512_maskz_loadu_epi8(load_mask, fingerprints + (w << 6));
+    for (int k = 0; k < num_hashes; ++k) {
+      __m512i target = _mm512_set1_epi8(static_cast<char>(hash8s[k]));
+      masks[k][w] = _mm512_mask_cmpeq_epi8_mask(load_mask, f, target);
+    }
+  }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t ProbeHashesAVX512(const uint64_t* pairs, int count,
+                                  uint64_t hash) {
+  __m512i target = _mm512_set1_epi64(static_cast<int64_t>(hash));
+  uint32_t raw = 0;
+  for (int i = 0; i < 4; ++i) {
+    __mmask8 r = _mm512_mask_cmpeq_epi64_mask(
+        0x55, _mm512_loadu_si512(pairs + i * 8), target);
+    raw |= static_cast<uint32_t>(r) << (i * 8);
+  }
+  return CompressEvenBits(raw) & CountMask(count);
+}
+
+#endif // ART_PROBE_X86
+
+// Ordered from the fastest, the last one is always supported.
+static const ProbeKernel Kernels[] = {
+#ifdef ART_PROBE_X86
+    {"avx512", ProbeFingerprintsAVX512,
+     ProbeFingerprintsBatchAVX512, ProbeHashesAVX512},
+    {"avx2", ProbeFingerprintsAVX2,
+     ProbeFingerprintsBatchAVX2, ProbeHashesAVX2},
+    {"sse4.2", ProbeFingerprintsSSE42,
+     ProbeFingerprintsBatchSSE42, ProbeHashesSSE42},
+#endif
+    {"scalar", ProbeFingerprintsScalar,
+     ProbeFingerprintsBatchScalar, ProbeHashesScalar},
+};
+
+static bool IsProbeKernelSupported(const ProbeKernel& kernel) {
+#ifdef ART_PROBE_X86
+  __builtin_cpu_init();
+  if (strcmp(kernel.name, "avx512") == 0) {
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+  }
+  if (strcmp(kernel.name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  }
+  if (strcmp(kernel.name, "sse4.2") == 0) {
+    return __builtin_cpu_supports("sse4.2");
+  }
+#endif
+  return true;
+}
+
+static ProbeKernel ChooseProbeKernel() {
+  for (auto& kernel : Kernels) {
+    if (IsProbeKernelSupported(kernel)) {
+      return kernel;
+    }
+  }
+  assert(false);
+  return Kernels[0];
+}
+
+static const ProbeKernel Kernel = ChooseProbeKernel();
+
+const ProbeKernel* GetProbeKernel(const char* name) {
+  for (auto& kernel : Kernels) {
+    if (strcmp(kernel.name, name) == 0) {
+      return IsProbeKernelSupported(kernel) ? &kernel : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+void ProbeFingerprints(const uint8_t* fingerprints, int size, uint8_t hash8,
+                       uint64_t* mask) {
+  Kernel.probe_fingerprints(fingerprints, size, hash8, mask);
+}
+
+void ProbeFingerprintsBatch(const uint8_t* fingerprints, int size,
+                            const uint8_t* hash8s, int num_hashes,
+                            uint64_t (*masks)[PROBE_MASK_WORDS]) {
+  Kernel.probe_fingerprints_batch(fingerprints, size, hash8s, num_hashes,
+                                  masks);
+}
+
+uint32_t ProbeHashes(const uint64_t* pairs, int count, uint64_t hash) {
+  return Kernel.probe_hashes(pairs, count, hash);
+}
+
+const char* GetProbeKernelName() {
+  return Kernel.name;
+}
+
+} // namespace ROCKSDB_NAMESPACE
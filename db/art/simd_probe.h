@@ -0,0 +1,51 @@
+//
+// Probe kernels for fingerprints in nvm node and hashes in buffers.
+//
+
+#pragma once
+#include <rocksdb/rocksdb_namespace.h>
+#include <cstdint>
+
+namespace ROCKSDB_NAMESPACE {
+
+// Number of 64-bit words in a fingerprint match mask, enough for 256 slots.
+#define PROBE_MASK_WORDS 4
+
+// Set bit i of mask if fingerprints[i] == hash8, for i < size, other bits
+// are cleared. Fingerprints beyond size are never read.
+void ProbeFingerprints(const uint8_t* fingerprints, int size, uint8_t hash8,
+                       uint64_t* mask);
+
+// Batched version of ProbeFingerprints for MultiGet, each block of
+// fingerprints is loaded once and compared against all of hash8s,
+// masks[k] is set for hash8s[k].
+void ProbeFingerprintsBatch(const uint8_t* fingerprints, int size,
+                            const uint8_t* hash8s, int num_hashes,
+                            uint64_t (*masks)[PROBE_MASK_WORDS]);
+
+// pairs holds 16 (hash, vptr) pairs like InnerNode::buffer_, return mask
+// whose bit i is set if pairs[i * 2] == hash, for i < count.
+uint32_t ProbeHashes(const uint64_t* pairs, int count, uint64_t hash);
+
+// Kernels are chosen by cpu features at startup, one of
+// "avx512", "avx2", "sse4.2" and "scalar".
+const char* GetProbeKernelName();
+
+struct ProbeKernel {
+  const char* name;
+  void (*probe_fingerprints)(const uint8_t*, int, uint8_t, uint64_t*);
+  void (*probe_fingerprints_batch)(const uint8_t*, int, const uint8_t*, int,
+                                   uint64_t (*)[PROBE_MASK_WORDS]);
+  uint32_t (*probe_hashes)(const uint64_t*, int, uint64_t);
+};
+
+// Used by tests to run every kernel, nullptr if the kernel named name is
+// unknown or not supported by cpu.
+const ProbeKernel* GetProbeKernel(const char* name);
+
+// Index of the highest set bit of a non-zero mask.
+inline int HighestBit(uint64_t mask) {
+  return 63 - __builtin_clzll(mask);
+}
+
+} // namespace ROCKSDB_NAMESPACE
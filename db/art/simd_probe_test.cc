@@ -0,0 +1,143 @@
+//
+// Tests of probe kernels, every kernel supported by cpu is checked
+// against a plain loop.
+//
+
+#include "db/art/simd_probe.h"
+
+#include <cstring>
+#include <vector>
+
+#include "test_util/testharness.h"
+#include "util/random.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Largest number of fingerprints probed, as in NVMNode.
+static const int kMaxSize = 224;
+
+class SimdProbeTest : public testing::TestWithParam<const char*> {
+ public:
+  void SetUp() override {
+    kernel_ = GetProbeKernel(GetParam());
+  }
+
+  // Fingerprints take values in [0, range) to get many matches.
+  void FillFingerprints(Random& rnd, int range) {
+    for (auto& f : fingerprints_) {
+      f = static_cast<uint8_t>(rnd.Uniform(range));
+    }
+  }
+
+  void ExpectedMask(int size, uint8_t hash8, uint64_t* mask) const {
+    memset(mask, 0, sizeof(uint64_t) * PROBE_MASK_WORDS);
+    for (int i = 0; i < size; i++) {
+      if (fingerprints_[i] == hash8) {
+        mask[i / 64] |= 1ULL << (i % 64);
+      }
+    }
+  }
+
+  const ProbeKernel* kernel_ = nullptr;
+  // Padded so that reads beyond size would be caught as matches.
+  uint8_t fingerprints_[PROBE_MASK_WORDS * 64];
+};
+
+TEST_P(SimdProbeTest, ProbeFingerprints) {
+  if (kernel_ == nullptr) {
+    GTEST_SUCCESS_("Skipped as probe kernel is not supported by cpu");
+    return;
+  }
+  Random rnd(301);
+  for (int size = 0; size <= kMaxSize; size++) {
+    FillFingerprints(rnd, 4);
+    uint8_t hash8 = static_cast<uint8_t>(rnd.Uniform(4));
+    memset(fingerprints_ + size, hash8, sizeof(fingerprints_) - size);
+    uint64_t mask[PROBE_MASK_WORDS];
+    uint64_t expected[PROBE_MASK_WORDS];
+    memset(mask, 0xff, sizeof(mask));
+    kernel_->probe_fingerprints(fingerprints_, size, hash8, mask);
+    ExpectedMask(size, hash8, expected);
+    for (int w = 0; w < PROBE_MASK_WORDS; w++) {
+      ASSERT_EQ(expected[w], mask[w]) << "size " << size << " word " << w;
+    }
+  }
+}
+
+TEST_P(SimdProbeTest, ProbeFingerprintsBatch) {
+  if (kernel_ == nullptr) {
+    GTEST_SUCCESS_("Skipped as probe kernel is not supported by cpu");
+    return;
+  }
+  Random rnd(301);
+  const int kMaxHashes = 32;
+  uint8_t hash8s[kMaxHashes];
+  uint64_t masks[kMaxHashes][PROBE_MASK_WORDS];
+  uint64_t expected[PROBE_MASK_WORDS];
+  for (int size = 0; size <= kMaxSize; size += 7) {
+    for (int num_hashes = 1; num_hashes <= kMaxHashes; num_hashes *= 2) {
+      FillFingerprints(rnd, 8);
+      for (int k = 0; k < num_hashes; k++) {
+        hash8s[k] = static_cast<uint8_t>(rnd.Uniform(8));
+      }
+      memset(masks, 0xff, sizeof(masks));
+      kernel_->probe_fingerprints_batch(fingerprints_, size, hash8s,
+                                        num_hashes, masks);
+      for (int k = 0; k < num_hashes; k++) {
+        ExpectedMask(size, hash8s[k], expected);
+        for (int w = 0; w < PROBE_MASK_WORDS; w++) {
+          ASSERT_EQ(expected[w], masks[k][w])
+              << "size " << size << " key " << k << " word " << w;
+        }
+      }
+      // Masks beyond num_hashes are untouched.
+      for (int k = num_hashes; k < kMaxHashes; k++) {
+        for (int w = 0; w < PROBE_MASK_WORDS; w++) {
+          ASSERT_EQ(~0ULL, masks[k][w]);
+        }
+      }
+    }
+  }
+}
+
+TEST_P(SimdProbeTest, ProbeHashes) {
+  if (kernel_ == nullptr) {
+    GTEST_SUCCESS_("Skipped as probe kernel is not supported by cpu");
+    return;
+  }
+  Random rnd(301);
+  // Hash and vptr pairs, vptr equals to hash to catch probing them.
+  uint64_t pairs[32];
+  for (int count = 0; count <= 16; count++) {
+    for (int i = 0; i < 16; i++) {
+      pairs[i * 2] = pairs[i * 2 + 1] = rnd.Uniform(4) + (1ULL << 40);
+    }
+    uint64_t hash = rnd.Uniform(4) + (1ULL << 40);
+    uint32_t expected = 0;
+    for (int i = 0; i < count; i++) {
+      if (pairs[i * 2] == hash) {
+        expected |= 1U << i;
+      }
+    }
+    ASSERT_EQ(expected, kernel_->probe_hashes(pairs, count, hash))
+        << "count " << count;
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(SimdProbeTest, SimdProbeTest,
+                        ::testing::Values("avx512", "avx2", "sse4.2",
+                                          "scalar"));
+
+TEST(SimdProbeKernelTest, Dispatch) {
+  // The chosen kernel is supported, and scalar always is.
+  ASSERT_NE(nullptr, GetProbeKernel(GetProbeKernelName()));
+  ASSERT_NE(nullptr, GetProbeKernel("scalar"));
+  ASSERT_EQ(nullptr, GetProbeKernel("neon"));
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
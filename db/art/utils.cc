@@ -7,6 +7,9 @@
 #include <functional>
 #include <cstring>
 #include <cmath>
+#include <memory>
+
+#include <rocksdb/threadpool.h>
 
 #include "art_node.h"
 #include "macros.h"
@@ -52,6 +55,28 @@ int EstimateDistinctCount(const uint8_t hll[64]) {
   return (int)estimated;
 }
 
+void ParallelFor(size_t n, int num_threads, size_t min_range_size,
+                 const std::function<void(size_t, size_t)>& func) {
+  if (num_threads <= 1 || n <= min_range_size) {
+    func(0, n);
+    return;
+  }
+
+  size_t num_ranges = std::min(static_cast<size_t>(num_threads) * 4,
+                               (n + min_range_size - 1) / min_range_size);
+  size_t range_size = (n + num_ranges - 1) / num_ranges;
+  num_ranges = (n + range_size - 1) / range_size;
+
+  std::unique_ptr<ThreadPool> thread_pool(NewThreadPool(num_threads));
+  thread_pool->SetJobCount(static_cast<int>(num_ranges));
+  for (size_t begin = 0; begin < n; begin += range_size) {
+    size_t end = std::min(begin + range_size, n);
+    thread_pool->SubmitJob([&func, begin, end]() { func(begin, end); });
+  }
+  thread_pool->Join();
+  thread_pool->JoinAllThreads();
+}
+
 ////////////////////////////////////////////////////////////////////////////
 
 InnerNode* AllocateLeafNode(uint8_t prefix_length,
@@ -66,6 +91,9 @@ InnerNode* AllocateLeafNode(uint8_t prefix_length,
   inode->nvm_node_ = nvm_node;
   inode->support_node = inode;
   inode->next_node = next_node;
+  if (next_node) {
+    next_node->prev_node = inode;
+  }
 
   uint64_t hdr = init_tag;
   SET_LAST_PREFIX(hdr, last_prefix);
@@ -75,10 +103,17 @@ InnerNode* AllocateLeafNode(uint8_t prefix_length,
 
   nvm_node->meta.next1 = next_node ? mgr->relative(next_node->nvm_node_) : -1;
   nvm_node->meta.header = hdr;
+  nvm_node->meta.node_info = 0;
   FLUSH(nvm_node, CACHE_LINE_SIZE);
   return inode;
 }
 
+void PersistNodeVptr(InnerNode* node, uint64_t vptr) {
+  auto nvm_node = node->nvm_node_;
+  nvm_node->meta.node_info = vptr;
+  PERSIST(&nvm_node->meta.node_info, sizeof(uint64_t));
+}
+
 InnerNode* RecoverInnerNode(NVMNode* nvm_node) {
   auto inode = new InnerNode();
 
@@ -91,8 +126,13 @@ InnerNode* RecoverInnerNode(NVMNode* nvm_node) {
     }
   }
 
+  // Rebuild hll from persisted hashes, and repair fingerprints that
+  // may be lost if crash happened before they were flushed in FlushBuffer.
   int h, bucket;
   uint8_t digit;
+  bool fingerprints_repaired = false;
+  KVStruct kv_info{};
+  uint8_t* fingerprints = nvm_node->meta.fingerprints_;
   int size = GET_SIZE(nvm_node->meta.header);
   for (int i = 0; i < size; ++i) {
     auto vptr = nvm_node->data[i * 2 + 1];
@@ -100,13 +140,24 @@ InnerNode* RecoverInnerNode(NVMNode* nvm_node) {
       continue;
     }
 
-    auto hash = nvm_node->data[i * 2];
-    bucket = (int)(hash & 63);
-    h = (int)(hash >> 6);
+    kv_info.hash = nvm_node->data[i * 2];
+    auto actual_hash = kv_info.actual_hash;
+    auto fingerprint = static_cast<uint8_t>(actual_hash);
+    if (unlikely(fingerprints[i] != fingerprint)) {
+      fingerprints[i] = fingerprint;
+      fingerprints_repaired = true;
+    }
+
+    bucket = (int)(actual_hash & 63);
+    h = (int)(actual_hash >> 6);
     digit = h == 0 ? 0 : __builtin_ctz(h) + 1;
     inode->hll_[bucket] = std::max(inode->hll_[bucket], digit);
   }
 
+  if (fingerprints_repaired) {
+    PERSIST(fingerprints, size);
+  }
+
   /*uint32_t status = INITIAL_STATUS(buffer_size);
   SET_LEAF(status);
   SET_NON_GROUP_START(status);
@@ -127,6 +178,10 @@ void InsertInnerNode(InnerNode* node, InnerNode* inserted) {
 
   auto prev_node = node->support_node;
   inserted->next_node = prev_node->next_node;
+  inserted->prev_node = prev_node;
+  if (inserted->next_node) {
+    inserted->next_node->prev_node = inserted;
+  }
   prev_node->next_node = inserted;
 
   auto prev_nvm_node = prev_node->nvm_node_;
@@ -182,6 +237,10 @@ void InsertSplitInnerNode(InnerNode* node, InnerNode* first_inserted,
 
   node->estimated_size_ = 0;
   last_inserted->next_node = prev_node->next_node;
+  if (last_inserted->next_node) {
+    last_inserted->next_node->prev_node = last_inserted;
+  }
+  first_inserted->prev_node = prev_node;
   prev_node->next_node = first_inserted;
 
   // Update last child node
@@ -4,9 +4,16 @@
 
 #pragma once
 #include <rocksdb/rocksdb_namespace.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <immintrin.h>
 #include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <util/hash.h>
 #include <db/dbformat.h>
 #include "macros.h"
@@ -71,6 +78,34 @@ inline void UpdateInsertTimes(uint64_t& vptr, uint64_t insert_times) {
   vptr &= 0xffff00ffffffffff;
   vptr |= (insert_times << 40);
 }
+
+// kv_size keeps exact size of records smaller than 32K. Size of a larger
+// record is kept negated in units of 1 << LARGE_KV_SIZE_SHIFT, which is
+// enough for records up to 64M, its exact size is parsed from vlog.
+#define LARGE_KV_SIZE_SHIFT 11
+
+inline void SetKVSize(KVStruct& kv_info, size_t size) {
+  if (likely(size <= INT16_MAX)) {
+    kv_info.kv_size = static_cast<int32_t>(size);
+    return;
+  }
+
+  size_t units = (size + (1 << LARGE_KV_SIZE_SHIFT) - 1) >> LARGE_KV_SIZE_SHIFT;
+  assert(units <= -INT16_MIN);
+  kv_info.kv_size = -static_cast<int32_t>(
+      std::min(units, static_cast<size_t>(-INT16_MIN)));
+}
+
+inline bool IsLargeKV(const KVStruct& kv_info) {
+  return kv_info.kv_size < 0;
+}
+
+// Size of record used in size accounting, large records are rounded up.
+inline int32_t GetKVSize(const KVStruct& kv_info) {
+  return likely(kv_info.kv_size >= 0)
+             ? kv_info.kv_size
+             : -kv_info.kv_size << LARGE_KV_SIZE_SHIFT;
+}
 #else
 struct KVStruct {
   union {
@@ -147,6 +182,12 @@ inline bool ActualVptrSame(uint64_t vptr1, uint64_t vptr2) {
 
 int EstimateDistinctCount(const uint8_t hll[64]);
 
+// Split [0, n) into ranges of at least min_range_size and call
+// func(begin, end) for each range on num_threads threads, return after
+// all ranges are done. Used in recovery.
+void ParallelFor(size_t n, int num_threads, size_t min_range_size,
+                 const std::function<void(size_t, size_t)>& func);
+
 /////////////////////////////////////////////////////
 // NVMNode
 
@@ -157,8 +198,14 @@ InnerNode* AllocateLeafNode(uint8_t prefix_length,
                             InnerNode* next_node = nullptr,
                             uint64_t init_tag = 0);
 
+// Restore buffer, hll and fingerprints of node from nvm,
+// it only touches nvm_node, so nodes can be recovered in parallel.
 InnerNode* RecoverInnerNode(NVMNode* nvm_node);
 
+// Non-leaf node keeps vptr of key equal to its prefix in node_info,
+// so that it survives a crash. Set 0 when node becomes leaf again.
+void PersistNodeVptr(InnerNode* node, uint64_t vptr);
+
 // inserted must be initialized
 void InsertSplitInnerNode(InnerNode* node, InnerNode* first_inserted,
                           InnerNode* last_inserted, size_t prefix_length);
@@ -183,32 +230,65 @@ int64_t GetNextRelativeNode(int64_t offset);
 
 /////////////////////////////////////////////////////
 
+// Background threads sleep in WaitForWork, and are woken up by Wakeup
+// when there is work for them, timeout of WaitForWork only bounds delay
+// of work that nobody signals.
 class BackgroundThread {
  public:
   virtual ~BackgroundThread() = default;
 
   void StartThread() {
     thread_stop_ = false;
+    has_work_ = false;
     background_thread_ = std::thread(&BackgroundThread::BGWork, this);
   }
 
   void StopThread() {
-    thread_stop_ = true;
+    {
+      std::lock_guard<std::mutex> wakeup_lk(wakeup_mutex_);
+      thread_stop_ = true;
+    }
+    wakeup_cond_.notify_one();
     cond_var_.notify_one();
     background_thread_.join();
   }
 
+  void Wakeup() {
+    {
+      std::lock_guard<std::mutex> wakeup_lk(wakeup_mutex_);
+      has_work_ = true;
+    }
+    wakeup_cond_.notify_one();
+  }
+
  private:
   virtual void BGWork() = 0;
 
  protected:
+  // Return false if thread is stopped.
+  template <class Rep, class Period>
+  bool WaitForWork(const std::chrono::duration<Rep, Period>& timeout) {
+    std::unique_lock<std::mutex> wakeup_lk(wakeup_mutex_);
+    wakeup_cond_.wait_for(wakeup_lk, timeout,
+                          [this] { return has_work_ || thread_stop_; });
+    has_work_ = false;
+    return !thread_stop_;
+  }
+
   std::thread background_thread_;
 
   std::mutex mutex_;
 
   std::condition_variable cond_var_;
 
-  bool thread_stop_ = false;
+  std::atomic<bool> thread_stop_{false};
+
+ private:
+  std::mutex wakeup_mutex_;
+
+  std::condition_variable wakeup_cond_;
+
+  bool has_work_ = false;
 };
 
 } // namespace ROCKSDB_NAMESPACE
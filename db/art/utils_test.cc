@@ -0,0 +1,63 @@
+//
+// Tests of record size packed into KVStruct.
+//
+
+#include "db/art/utils.h"
+
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class KVSizeTest : public testing::Test {};
+
+TEST_F(KVSizeTest, SmallSize) {
+  for (size_t size : {(size_t)0, (size_t)1, (size_t)100, (size_t)4096,
+                      (size_t)INT16_MAX}) {
+    KVStruct kv_info(0, 0);
+    SetKVSize(kv_info, size);
+    ASSERT_FALSE(IsLargeKV(kv_info));
+    ASSERT_EQ(size, (size_t)GetKVSize(kv_info));
+  }
+}
+
+TEST_F(KVSizeTest, LargeSize) {
+  const size_t unit = 1 << LARGE_KV_SIZE_SHIFT;
+  const size_t max_size = (size_t)-INT16_MIN << LARGE_KV_SIZE_SHIFT;
+  for (size_t size : {(size_t)INT16_MAX + 1, unit * 16, unit * 16 + 1,
+                      (size_t)1 << 20, ((size_t)1 << 20) + 12345,
+                      max_size - unit + 1, max_size}) {
+    KVStruct kv_info(0, 0);
+    SetKVSize(kv_info, size);
+    ASSERT_TRUE(IsLargeKV(kv_info));
+    // Size is rounded up to units.
+    size_t kv_size = GetKVSize(kv_info);
+    ASSERT_GE(kv_size, size);
+    ASSERT_LT(kv_size, size + unit);
+    ASSERT_EQ(0U, kv_size % unit);
+  }
+}
+
+TEST_F(KVSizeTest, KeepVptr) {
+  uint64_t vptr = 0x123456789aULL;
+  for (size_t size : {(size_t)10, (size_t)1 << 24}) {
+    KVStruct kv_info(0, vptr);
+    UpdateInsertTimes(kv_info.vptr, 7);
+    SetKVSize(kv_info, size);
+    ASSERT_EQ(vptr, kv_info.actual_vptr);
+    ASSERT_EQ(7, GetInsertTimes(kv_info.vptr));
+
+    // And the other way round.
+    kv_info.actual_vptr = vptr + 1;
+    UpdateInsertTimes(kv_info.vptr, 8);
+    ASSERT_GE((size_t)GetKVSize(kv_info), size);
+    ASSERT_LT((size_t)GetKVSize(kv_info),
+              size + (1 << LARGE_KV_SIZE_SHIFT));
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -8,15 +8,24 @@
 #include <cassert>
 #include <string>
 #include <cstring>
+#include <functional>
 
 #include <util/hash.h>
 #include <util/autovector.h>
+#include <rocksdb/threadpool.h>
+#include "port/port.h"
+#include "util/compression.h"
+#include "util/crc32c.h"
 #include "db/write_batch_internal.h"
+#include "db/art/compactor.h"
 #include "db/art/nvm_manager.h"
 #include "db/art/nvm_node.h"
 #include "db/art/utils.h"
+#include "db/art/simd_probe.h"
 #include "db/art/global_memtable.h"
 #include "db/art/node_allocator.h"
+#include "db/art/heat_group.h"
+#include "db/art/logger.h"
 
 namespace ROCKSDB_NAMESPACE {
 
@@ -33,9 +42,6 @@ int SearchVptr(InnerNode* inner_node, uint32_t hash, int rows,
 
   auto nvm_node = inner_node->nvm_node_;
   auto data = nvm_node->data;
-  auto fingerprints = nvm_node->meta.fingerprints_;
-
-  int search_rows = (rows + 1) / 2 - 1;
   int size = rows * 16;
 
   KVStruct first_kv;
@@ -44,19 +50,16 @@ int SearchVptr(InnerNode* inner_node, uint32_t hash, int rows,
   KVStruct kv_info;
   Slice got_key;
   int found_times = 0;
-  auto hash8 = (uint8_t)hash;
-
-  __m256i target = _mm256_set1_epi8(hash8);
-  for (int i = search_rows; i >= 0; --i) {
-    int base = i << 5;
-    __m256i f = _mm256_load_si256(
-        reinterpret_cast<const __m256i *>(fingerprints + base));
-    __m256i r = _mm256_cmpeq_epi8(f, target);
-    auto res = (unsigned int)_mm256_movemask_epi8(r);
+
+  uint64_t mask[PROBE_MASK_WORDS];
+  ProbeFingerprints(nvm_node->meta.fingerprints_, size, (uint8_t)hash, mask);
+
+  for (int w = PROBE_MASK_WORDS - 1; w >= 0; --w) {
+    auto res = mask[w];
     while (res > 0) {
-      int found = 31 - __builtin_clz(res);
-      res -= (1 << found);
-      int index = found + base;
+      int found = HighestBit(res);
+      res &= ~(1ULL << found);
+      int index = (w << 6) + found;
       assert(index >= 0);
       kv_info.hash = data[index * 2];
       kv_info.vptr = data[index * 2 + 1];
@@ -73,9 +76,9 @@ int SearchVptr(InnerNode* inner_node, uint32_t hash, int rows,
           vptr = data[index * 2 + 1];
           return index;
         } else {
-          inner_node->estimated_size_ -= kv_info.kv_size;
+          inner_node->estimated_size_ -= GetKVSize(kv_info);
           if (inner_node->heat_group_) {
-            inner_node->heat_group_->UpdateSqueezedSize(kv_info.kv_size);
+            inner_node->heat_group_->UpdateSqueezedSize(GetKVSize(kv_info));
           }
           assert(first_index >= 0);
           int insert_times = first_kv.insert_times + kv_info.insert_times;
@@ -104,20 +107,71 @@ int SearchVptr(InnerNode* inner_node, uint32_t hash, int rows,
 
 auto RecordPrefixSize = WriteBatchInternal::kRecordPrefixSize;
 
-void VLogManager::PopFreeSegment() {
-  while (free_segments_.size() < 36) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+// Offsets of fields in record prefix
+const size_t kRecordIndexOffset = 1 + sizeof(SequenceNumber);
+const size_t kRecordChecksumOffset = kRecordIndexOffset + sizeof(RecordIndex);
+
+// Checksum covers type, sequence number, key and value of record. Record
+// index is left out, so relocated records keep their checksums.
+static uint32_t RecordChecksum(const char* record_start, size_t record_size) {
+  uint32_t crc = crc32c::Value(record_start, kRecordIndexOffset);
+  crc = crc32c::Extend(crc, record_start + RecordPrefixSize,
+                       record_size - RecordPrefixSize);
+  return crc32c::Mask(crc);
+}
+
+static bool ChecksumMatches(const char* record_start, size_t record_size) {
+  return ((uint32_t*)(record_start + kRecordChecksumOffset))[0] ==
+         RecordChecksum(record_start, record_size);
+}
+
+// Return size of record, or 0 if it is malformed. Record can't exceed limit.
+static size_t ParseRecordSize(const char* record_start, size_t limit) {
+  if (limit < RecordPrefixSize) {
+    return 0;
+  }
+
+  ValueType type = ((ValueType*)record_start)[0];
+  if (type != kTypeValue && type != kTypeDeletion &&
+      type != kTypeVLogCompressedValue) {
+    return 0;
   }
 
-  cur_segment_ = GetSegmentFromFreeQueue();
-  header_ = (VLogSegmentHeader*)cur_segment_;
-  segment_remain_ = vlog_segment_size_ - header_->offset_;
-  assert(header_->offset_ < vlog_segment_size_);
+  Slice slice(record_start + RecordPrefixSize, limit - RecordPrefixSize);
+  Slice key, value;
+  if (!GetLengthPrefixedSlice(&slice, &key) ||
+      (type != kTypeDeletion && !GetLengthPrefixedSlice(&slice, &value))) {
+    return 0;
+  }
+  return slice.data() - record_start;
+}
+
+void VLogManager::PopFreeSegment() {
+  free_segments_.wait_for_size(36);
+
+  char* segment = GetSegmentFromFreeQueue();
+  auto header = (VLogSegmentHeader*)segment;
+  assert(header->offset_ < vlog_segment_size_);
+
+  size_t segment_id = GetIndex(segment);
+  auto& cursor = cursors_[segment_id];
+  uint64_t pos = ((uint64_t)header->offset_ << 32) | header->total_count_;
+  cursor.persisted = pos;
+  cursor.published.store(pos, std::memory_order_relaxed);
+  cursor.reserved.store(pos, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lk(segment_mutex_);
+    cur_segment_id_.store(segment_id, std::memory_order_release);
+  }
+  segment_cv_.notify_all();
 }
 
 char* VLogManager::GetSegmentFromFreeQueue() {
   char* segment = free_segments_.pop_front();
   auto index = GetIndex(segment);
+  if (free_segments_.size() <= force_gc_ratio_) {
+    Wakeup();
+  }
 
   std::lock_guard<SpinMutex> status_lk(segment_statuses_[index].mutex);
   segment_statuses_[index].status = kSegmentWriting;
@@ -128,7 +182,11 @@ void VLogManager::PushToUsedQueue(char* segment) {
   auto index = GetIndex(segment);
   std::lock_guard<SpinMutex> status_lk(segment_statuses_[index].mutex);
   segment_statuses_[index].status = kSegmentWritten;
-  used_segments_->PushSegment(index);
+  used_segments_->PushSegment(
+      index, ((VLogSegmentHeader*)segment)->total_count_);
+  if (free_segments_.size() <= force_gc_ratio_) {
+    Wakeup();
+  }
 }
 
 // Why size of vlog header equals vlog_segment_size_ / 128 ?
@@ -136,21 +194,39 @@ void VLogManager::PushToUsedQueue(char* segment) {
 VLogManager::VLogManager(const DBOptions& options, bool recovery)
     : vlog_file_size_(options.vlog_file_size),
       vlog_segment_size_(options.vlog_segment_size),
+      vlog_segment_shift_(__builtin_ctzll(options.vlog_segment_size)),
       vlog_segment_num_(vlog_file_size_ / vlog_segment_size_),
       vlog_header_size_(vlog_segment_size_ / 128),
       vlog_bitmap_size_(vlog_header_size_ - sizeof(VLogSegmentHeader)),
       force_gc_ratio_((size_t) (options.vlog_force_gc_ratio_ * vlog_segment_num_)),
-      stored_segment_keys_(new char[vlog_segment_size_ * 4]),
+      num_recovery_threads_(options.num_recovery_threads),
+      num_gc_threads_(std::max(options.num_vlog_gc_threads, 1)),
+      compression_type_(options.vlog_compression),
       segment_statuses_(new StatusLock[vlog_segment_num_]){
+  // Segment id is taken from high bits of vptr, which has 40 bits.
+  assert((vlog_segment_size_ & (vlog_segment_size_ - 1)) == 0);
+  assert(vlog_segment_size_ >= VLOG_MIN_SEGMENT_SIZE &&
+         vlog_segment_size_ < VLOG_MAX_SEGMENT_SIZE);
+  assert(vlog_file_size_ <= (1ULL << 40));
+
   pmemptr_ = GetMappedAddress("vlog");
-  used_segments_ = new SegmentQueue(8192);
+  used_segments_ = new SegmentQueue(vlog_segment_num_);
+  cursors_ = new AppendCursor[vlog_segment_num_];
 
   // TODO: update segment_statuses on recovery
   recovery ? Recover() : Initialize();
 
   NVM_BARRIER;
 
-  segment_for_gc_ = GetSegmentFromFreeQueue();
+  for (int i = 0; i < num_gc_threads_; ++i) {
+    auto job = new GCJob();
+    job->stored_keys = new char[vlog_segment_size_ * GC_BATCH_SEGMENTS];
+    job->compression_ctx = new CompressionContext(compression_type_);
+    gc_jobs_.push_back(job);
+  }
+  gc_thread_pool_ = NewThreadPool(num_gc_threads_);
+
+  InitGCSegments();
 
   PopFreeSegment();
 
@@ -159,30 +235,57 @@ VLogManager::VLogManager(const DBOptions& options, bool recovery)
 
 VLogManager::~VLogManager() {
   StopThread();
-  delete[] stored_segment_keys_;
-  printf("gc used segments = %d, gc freed segments = %d\n",
-         gc_used_.load(), gc_freed_.load() - gc_used_.load());
+  gc_thread_pool_->JoinAllThreads();
+  delete gc_thread_pool_;
+  for (auto job : gc_jobs_) {
+    delete[] job->stored_keys;
+    delete job->compression_ctx;
+    delete job;
+  }
+  delete[] cursors_;
+  printf("gc used segments = %d, gc freed segments = %d, "
+         "gc corrupted records = %d\n",
+         gc_used_.load(), gc_freed_.load() - gc_used_.load(),
+         gc_corrupted_.load());
 }
 
 void VLogManager::Recover() {
+  // Headers are checked and reset in parallel, segments are pushed into
+  // queues afterwards in the order of index. Garbage of used segments is
+  // counted from their bitmaps, -1 marks free segments.
+  std::vector<int> garbage(vlog_segment_num_, -1);
+  ParallelFor(vlog_segment_num_, num_recovery_threads_, 16,
+              [&](size_t begin, size_t end) {
+                char* cur_ptr = pmemptr_ + vlog_segment_size_ * begin;
+                for (size_t i = begin; i < end; ++i) {
+                  auto header = (VLogSegmentHeader*)cur_ptr;
+                  if (header->total_count_ > 0) {
+                    segment_statuses_[i].status = kSegmentWritten;
+                    int total_count = header->total_count_;
+                    int live_count = 0;
+                    for (int r = 0; r < total_count; ++r) {
+                      live_count += (header->bitmap_[r / 8] >> (r % 8)) & 1;
+                    }
+                    garbage[i] = total_count - live_count;
+                  } else {
+                    segment_statuses_[i].status = kSegmentFree;
+                    header->offset_ = vlog_header_size_;
+                    header->total_count_ = 0;
+                    memset(header->bitmap_, -1, vlog_bitmap_size_);
+                  }
+                  FLUSH(cur_ptr, vlog_header_size_);
+                  cur_ptr += vlog_segment_size_;
+                }
+              });
+
   char* cur_ptr = pmemptr_;
   for (size_t i = 0; i < vlog_segment_num_; ++i) {
-    auto header = (VLogSegmentHeader*)cur_ptr;
-    if (header->total_count_ > 0) {
-      segment_statuses_[i].status = kSegmentWritten;
-      FLUSH(cur_ptr, vlog_header_size_);
-      used_segments_->PushSegment((cur_ptr - pmemptr_) / vlog_segment_size_);
-      cur_ptr += vlog_segment_size_;
-      continue;
+    if (garbage[i] >= 0) {
+      used_segments_->PushSegment(i, GetHeader(i)->total_count_);
+      used_segments_->AddGarbage(i, garbage[i]);
+    } else {
+      free_segments_.emplace_back(cur_ptr);
     }
-
-    assert(header->total_count_ == 0);
-    segment_statuses_[i].status = kSegmentFree;
-    header->offset_ = vlog_header_size_;
-    header->total_count_ = 0;
-    memset(header->bitmap_, -1, vlog_bitmap_size_);
-    FLUSH(cur_ptr, vlog_header_size_);
-    free_segments_.emplace_back(cur_ptr);
     cur_ptr += vlog_segment_size_;
   }
 }
@@ -192,12 +295,13 @@ void VLogManager::Reset() {
 
   free_segments_.clear();
   gc_pages_.clear();
+  used_segments_->Clear();
 
   Initialize();
 
   NVM_BARRIER;
 
-  segment_for_gc_ = GetSegmentFromFreeQueue();
+  InitGCSegments();
 
   PopFreeSegment();
 
@@ -218,40 +322,134 @@ void VLogManager::Initialize() {
   }
 }
 
+void VLogManager::InitGCSegments() {
+  segment_for_gc_ = GetSegmentFromFreeQueue();
+  // Destinations of workers are taken when they are first written to
+  for (auto job : gc_jobs_) {
+    for (auto& segment : job->dest_segments) {
+      segment = nullptr;
+    }
+  }
+}
+
 void VLogManager::SetMemtable(GlobalMemtable* mem) {
   mem_ = mem;
 }
 
-uint64_t VLogManager::AddRecord(const Slice& slice, uint32_t record_count) {
-  assert(header_->offset_ <= vlog_segment_size_);
+// Record indexes are assigned after reservation, they are written with
+// non-temporal stores like the rest of batch, together with checksums.
+// Records are parsed from batch in dram instead of the copy in nvm.
+static void StoreRecordPrefixes(char* dest, const Slice& batch,
+                                uint32_t record_count,
+                                RecordIndex first_index) {
+  Slice slice = batch;
+  Slice key;
+  uint32_t val_len = 0;
+  for (uint32_t c = 0; c < record_count; ++c) {
+    auto record_start = slice.data();
+    ValueType type = ((ValueType*)slice.data())[0];
+    slice.remove_prefix(RecordPrefixSize);
+    GetLengthPrefixedSlice(&slice, &key);
+    if (type == kTypeValue) {
+      GetVarint32(&slice, &val_len);
+      slice.remove_prefix(val_len);
+    }
 
-  uint32_t left = slice.size();
-  while (segment_remain_ < left) {
-    PushToUsedQueue(cur_segment_);
-    PopFreeSegment();
+    auto checksum = RecordChecksum(record_start, slice.data() - record_start);
+    auto prefix = dest + (record_start - batch.data());
+#ifdef USE_PMEM
+    _mm_stream_si32((int*)(prefix + kRecordIndexOffset),
+                    (int)(first_index + c));
+    _mm_stream_si32((int*)(prefix + kRecordChecksumOffset), (int)checksum);
+#else
+    *((RecordIndex*)(prefix + kRecordIndexOffset)) = first_index + c;
+    *((uint32_t*)(prefix + kRecordChecksumOffset)) = checksum;
+#endif
   }
+}
 
-  auto offset = header_->offset_;
-  uint64_t vptr = (cur_segment_ - pmemptr_) + offset;
-  MEMCPY(cur_segment_ + offset, slice.data(), left, PMEM_F_MEM_NONTEMPORAL);
-  NVM_BARRIER;
+void VLogManager::PublishRange(AppendCursor& cursor,
+                               uint64_t start, uint64_t end) {
+  while (cursor.published.load(std::memory_order_acquire) != start) {
+    port::AsmVolatilePause();
+  }
+  cursor.published.store(end, std::memory_order_release);
+}
 
-  segment_remain_ -= left;
-  header_->total_count_ += record_count;
-  header_->offset_ += left;
-  PERSIST(header_, CACHE_LINE_SIZE);
+void VLogManager::PersistCursor(size_t segment_id, uint64_t end) {
+  auto& cursor = cursors_[segment_id];
+  std::lock_guard<SpinMutex> persist_lk(cursor.persist_mutex);
+  if (cursor.persisted >= end) {
+    return;
+  }
 
-  assert(segment_remain_ < vlog_segment_size_);
+  uint64_t published = cursor.published.load(std::memory_order_acquire);
+  auto header = GetHeader(segment_id);
+  header->offset_ = published >> 32;
+  header->total_count_ = (uint32_t)published;
+  PERSIST(header, CACHE_LINE_SIZE);
+  cursor.persisted = published;
+}
 
-  return vptr;
+// Writers reserve their ranges with fetch_add on cursor of current segment
+// and copy batches in parallel. The writer whose range crosses end of
+// segment seals it after ranges before it are published, and the others
+// beyond end wait for the next segment and retry.
+VLogReservation VLogManager::ReserveRecord(size_t size,
+                                           uint32_t record_count) {
+  assert(size <= GetMaxBatchSize());
+
+  uint64_t delta = ((uint64_t)size << 32) | record_count;
+  while (true) {
+    size_t segment_id = cur_segment_id_.load(std::memory_order_acquire);
+    auto& cursor = cursors_[segment_id];
+    uint64_t start = cursor.reserved.fetch_add(delta);
+    uint64_t offset = start >> 32;
+
+    if (offset + size <= vlog_segment_size_) {
+      VLogReservation reservation;
+      reservation.segment_id = segment_id;
+      reservation.start = start;
+      return reservation;
+    }
+
+    if (offset <= vlog_segment_size_) {
+      PublishRange(cursor, start, start);
+      PersistCursor(segment_id, start);
+      PushToUsedQueue(pmemptr_ + vlog_segment_size_ * segment_id);
+      PopFreeSegment();
+    } else {
+      std::unique_lock<std::mutex> lk(segment_mutex_);
+      segment_cv_.wait(lk, [&] {
+        return cur_segment_id_.load(std::memory_order_acquire) != segment_id;
+      });
+    }
+  }
 }
 
-RecordIndex VLogManager::GetFirstIndex(size_t wal_size) const {
-  return segment_remain_ < wal_size ? 0 : header_->total_count_;
+uint64_t VLogManager::CommitRecord(const VLogReservation& reservation,
+                                   const Slice& slice,
+                                   uint32_t record_count) {
+  size_t segment_id = reservation.segment_id;
+  uint64_t start = reservation.start;
+  uint64_t delta = ((uint64_t)slice.size() << 32) | record_count;
+  uint64_t vptr = vlog_segment_size_ * segment_id + (start >> 32);
+
+  char* dest = pmemptr_ + vptr;
+  MEMCPY(dest, slice.data(), slice.size(),
+         PMEM_F_MEM_NODRAIN | PMEM_F_MEM_NONTEMPORAL);
+  StoreRecordPrefixes(dest, slice, record_count, (RecordIndex)start);
+  NVM_BARRIER;
+
+  auto& cursor = cursors_[segment_id];
+  PublishRange(cursor, start, start + delta);
+  PersistCursor(segment_id, start + delta);
+  return vptr;
 }
 
 void VLogManager::GetKey(uint64_t vptr, Slice& key) {
   GetActualVptr(vptr);
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
   Slice slice(pmemptr_ + vptr + RecordPrefixSize, vlog_segment_size_);
   GetLengthPrefixedSlice(&slice, &key);
 }
@@ -259,114 +457,212 @@ void VLogManager::GetKey(uint64_t vptr, Slice& key) {
 void VLogManager::GetKeyIndex(uint64_t vptr, std::string& key,
                               RecordIndex& index) {
   GetActualVptr(vptr);
-  index = ((uint32_t*)(pmemptr_ + vptr + 9))[0];
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
+  index = ((uint32_t*)(pmemptr_ + vptr + kRecordIndexOffset))[0];
   Slice slice(pmemptr_ + vptr + RecordPrefixSize, vlog_segment_size_);
   GetLengthPrefixedSlice(&slice, key);
 }
 
-ValueType VLogManager::GetKeyValue(uint64_t vptr,
-                                   std::string& key, std::string& value,
-                                   SequenceNumber& seq_num) {
+SequenceNumber VLogManager::GetSeqNum(uint64_t vptr) {
+  GetActualVptr(vptr);
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
+  return ((uint64_t*)(pmemptr_ + vptr + 1))[0];
+}
+
+size_t VLogManager::GetRecordSize(uint64_t vptr) {
+  GetActualVptr(vptr);
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
+  const char* record_start = pmemptr_ + vptr;
+  ValueType type = ((ValueType*)record_start)[0];
+  Slice slice(record_start + RecordPrefixSize, vlog_segment_size_);
+  Slice key, value;
+  GetLengthPrefixedSlice(&slice, &key);
+  if (type != kTypeDeletion) {
+    GetLengthPrefixedSlice(&slice, &value);
+  }
+  return slice.data() - record_start;
+}
+
+Status VLogManager::VerifyRecord(uint64_t vptr) {
+  GetActualVptr(vptr);
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
+  const char* record_start = pmemptr_ + vptr;
+  size_t limit = vlog_segment_size_ - (vptr & (vlog_segment_size_ - 1));
+  size_t record_size = ParseRecordSize(record_start, limit);
+  if (unlikely(!record_size || !ChecksumMatches(record_start, record_size))) {
+    return Status::Corruption("vlog record checksum mismatch");
+  }
+  return Status::OK();
+}
+
+bool VLogManager::MatchKey(uint64_t vptr, const Slice& key,
+                           ValueType& type, Slice& value) {
+  GetActualVptr(vptr);
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
+  Slice slice(pmemptr_ + vptr + RecordPrefixSize, vlog_segment_size_);
+  Slice found_key;
+  GetLengthPrefixedSlice(&slice, &found_key);
+  if (found_key != key) {
+    return false;
+  }
+
+  type = ((ValueType*)(pmemptr_ + vptr))[0];
+  assert(type == kTypeValue || type == kTypeDeletion ||
+         type == kTypeVLogCompressedValue);
+  if (type != kTypeDeletion) {
+    GetLengthPrefixedSlice(&slice, &value);
+  }
+  return true;
+}
+
+Status VLogManager::UncompressValue(const Slice& value,
+                                    std::string* uncompressed) {
+  if (value.empty()) {
+    return Status::Corruption("empty compressed vlog value");
+  }
+
+  auto type = static_cast<CompressionType>(value[0]);
+  UncompressionContext context(type);
+  UncompressionInfo info(context, UncompressionDict::GetEmptyDict(), type);
+  size_t uncompressed_size = 0;
+  auto data = UncompressData(info, value.data() + 1, value.size() - 1,
+                             &uncompressed_size, 2 /* format version */);
+  if (!data) {
+    return Status::Corruption("failed to uncompress vlog value");
+  }
+  uncompressed->assign(data.get(), uncompressed_size);
+  return Status::OK();
+}
+
+Status VLogManager::GetKeyValue(uint64_t vptr,
+                                std::string& key, std::string& value,
+                                SequenceNumber& seq_num, ValueType& type) {
   GetActualVptr(vptr);
-  ValueType type = ((ValueType*)(pmemptr_ + vptr))[0];
-  assert(type == kTypeValue || type == kTypeDeletion);
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
+  type = ((ValueType*)(pmemptr_ + vptr))[0];
   seq_num = ((uint64_t*)(pmemptr_ + vptr + 1))[0];
   Slice slice(pmemptr_ + vptr + RecordPrefixSize, vlog_segment_size_);
   GetLengthPrefixedSlice(&slice, key);
 
-  switch (type) {
-    case kTypeValue:
-      GetLengthPrefixedSlice(&slice, value);
-      break;
-    default:
-      break;
+  Slice compressed;
+  if (type == kTypeValue) {
+    GetLengthPrefixedSlice(&slice, value);
+  } else if (type == kTypeVLogCompressedValue) {
+    GetLengthPrefixedSlice(&slice, &compressed);
+    type = kTypeValue;
+    return UncompressValue(compressed, &value);
+  } else {
+    assert(type == kTypeDeletion);
   }
 
-  return type;
+  return Status::OK();
 }
 
-ValueType VLogManager::GetKeyValue(uint64_t vptr,
-                                   std::string& key, Slice& value,
-                                   SequenceNumber& seq_num,
-                                   RecordIndex& index) {
+Status VLogManager::GetKeyValue(
+    uint64_t vptr, Slice& key, Slice& value, SequenceNumber& seq_num,
+    RecordIndex& index, std::deque<std::string>* uncompressed_values,
+    ValueType& type) {
   GetActualVptr(vptr);
-  ValueType type = ((ValueType*)(pmemptr_ + vptr))[0];
-  assert(type == kTypeValue || type == kTypeDeletion);
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
+  type = ((ValueType*)(pmemptr_ + vptr))[0];
   seq_num = ((uint64_t*)(pmemptr_ + vptr + 1))[0];
-  index = ((uint32_t*)(pmemptr_ + vptr + 9))[0];
+  index = ((uint32_t*)(pmemptr_ + vptr + kRecordIndexOffset))[0];
   Slice slice(pmemptr_ + vptr + RecordPrefixSize, vlog_segment_size_);
-  GetLengthPrefixedSlice(&slice, key);
+  GetLengthPrefixedSlice(&slice, &key);
 
-  switch (type) {
-    case kTypeValue:
-      GetLengthPrefixedSlice(&slice, &value);
-      break;
-    default:
-      break;
+  Slice compressed;
+  if (type == kTypeValue) {
+    GetLengthPrefixedSlice(&slice, &value);
+  } else if (type == kTypeVLogCompressedValue) {
+    GetLengthPrefixedSlice(&slice, &compressed);
+    uncompressed_values->emplace_back();
+    auto s = UncompressValue(compressed, &uncompressed_values->back());
+    value = uncompressed_values->back();
+    type = kTypeValue;
+    return s;
+  } else {
+    assert(type == kTypeDeletion);
   }
 
-  return type;
+  return Status::OK();
 }
 
-ValueType VLogManager::GetKeyValue(uint64_t vptr,
-                                   std::string& key, std::string& value) {
+Status VLogManager::GetKeyValue(uint64_t vptr,
+                                std::string& key, std::string& value,
+                                ValueType& type) {
   GetActualVptr(vptr);
+  NVM_READ(pmemptr_ + vptr, CACHE_LINE_SIZE);
 
   [[maybe_unused]] char* segment =
       pmemptr_ + vptr / vlog_segment_size_ * vlog_segment_size_;
 
-  ValueType type = ((ValueType *)(pmemptr_ + vptr))[0];
-  assert(type == kTypeValue || type == kTypeDeletion);
+  type = ((ValueType *)(pmemptr_ + vptr))[0];
   Slice slice(pmemptr_ + vptr + RecordPrefixSize, vlog_segment_size_);
   GetLengthPrefixedSlice(&slice, key);
 
-  switch (type) {
-    case kTypeValue:
-      GetLengthPrefixedSlice(&slice, value);
-      break;
-    default:
-      break;
+  Slice compressed;
+  if (type == kTypeValue) {
+    GetLengthPrefixedSlice(&slice, value);
+  } else if (type == kTypeVLogCompressedValue) {
+    GetLengthPrefixedSlice(&slice, &compressed);
+    type = kTypeValue;
+    return UncompressValue(compressed, &value);
+  } else {
+    assert(type == kTypeDeletion);
   }
 
-  return type;
+  return Status::OK();
 }
 
-void VLogManager::ReadAndSortData(std::vector<char*>& segments) {
+void VLogManager::ReadAndSortData(GCJob* job) {
+  auto& gc_data = job->gc_data;
   gc_data.clear();
   size_t cur_pos = 0;
 
-  for (auto segment : segments) {
+  for (auto segment : job->segments) {
+    AdviseMemory(segment, vlog_segment_size_, MADV_SEQUENTIAL);
     auto header = (VLogSegmentHeader*)segment;
     Slice slice(segment + vlog_header_size_,
                 vlog_segment_size_ - vlog_header_size_);
 
-    uint16_t read = 0;
-    uint32_t key_length, value_length;
+    uint32_t read = 0;
+    Slice key_slice, key;
 
     auto total_count = header->total_count_;
     auto bitmap = header->bitmap_;
     while (read < total_count) {
       auto record_start = slice.data();
-      ValueType type = *((ValueType*)record_start);
-      slice.remove_prefix(RecordPrefixSize);
-
-      GetVarint32(&slice, &key_length);
-      memcpy(stored_segment_keys_ + cur_pos, slice.data(), key_length);
-      slice.remove_prefix(key_length);
-      if (type == kTypeValue) {
-        GetVarint32(&slice, &value_length);
-        slice.remove_prefix(value_length);
+      size_t record_size = ParseRecordSize(record_start, slice.size());
+
+      // Records after a malformed one can't be located, they are lost.
+      if (unlikely(!record_size)) {
+        RECORD_INFO("vlog segment %zu: %u malformed records\n",
+                    GetIndex(segment), total_count - read);
+        gc_corrupted_ += total_count - read;
+        break;
       }
+      slice.remove_prefix(record_size);
 
-      // TODO: Check record
+      // Only live records are checked. Corrupted ones are still relocated,
+      // so that reads verifying checksums report them.
       if (bitmap[read / 8] & (1 << (read % 8))) {
-        std::string record(record_start, slice.data() - record_start);
-        gc_data.emplace_back(pmemptr_, record_start,
-                             slice.data() - record_start,
-                              stored_segment_keys_ + cur_pos, key_length);
+        bool corrupted = !ChecksumMatches(record_start, record_size);
+        if (unlikely(corrupted)) {
+          RECORD_INFO("vlog segment %zu: record %u checksum mismatch\n",
+                      GetIndex(segment), read);
+          ++gc_corrupted_;
+        }
+
+        key_slice = Slice(record_start + RecordPrefixSize,
+                          record_size - RecordPrefixSize);
+        GetLengthPrefixedSlice(&key_slice, &key);
+        memcpy(job->stored_keys + cur_pos, key.data(), key.size());
+        gc_data.emplace_back(pmemptr_, record_start, record_size,
+                             job->stored_keys + cur_pos, key.size(),
+                             corrupted);
+        cur_pos += key.size();
       }
 
-      cur_pos += key_length;
       ++read;
     }
   }
@@ -378,143 +674,251 @@ void VLogManager::ReadAndSortData(std::vector<char*>& segments) {
 }
 
 void VLogManager::BGWork() {
-  std::vector<char*> segments;
-
   while (!thread_stop_) {
-    if (free_segments_.size() > force_gc_ratio_ || free_segments_.size() < 32) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    // Woken up when free segments drop to force_gc_ratio_, a segment is
+    // filled, or reclaimed segments are freed, timeout is a safety net.
+    size_t num_free = free_segments_.size();
+    if (num_free > force_gc_ratio_ || num_free < 32) {
+      WaitForWork(std::chrono::milliseconds(100));
       continue;
     }
 
-    if (thread_stop_) {
-      break;
+    // More workers run as free segments get fewer, all of them run when
+    // free segments are close to the floor.
+    size_t deficit = force_gc_ratio_ - num_free;
+    size_t num_jobs = std::min(
+        gc_jobs_.size(), 1 + deficit * gc_jobs_.size() / force_gc_ratio_);
+
+    // SegmentQueue has a single consumer, so victims are claimed here and
+    // records are read and relocated by workers.
+    size_t num_claimed_jobs = 0;
+    for (; num_claimed_jobs < num_jobs; ++num_claimed_jobs) {
+      auto job = gc_jobs_[num_claimed_jobs];
+      job->segments.clear();
+      while (job->segments.size() < GC_BATCH_SEGMENTS) {
+        auto index = used_segments_->GetSegment();
+        if (index < 0) {
+          break;
+        }
+        job->segments.push_back(pmemptr_ + vlog_segment_size_ * index);
+        std::lock_guard<SpinMutex> status_lk(segment_statuses_[index].mutex);
+        segment_statuses_[index].status = kSegmentGC;
+      }
+      if (job->segments.empty()) {
+        break;
+      }
     }
 
-    segments.resize(4);
-    for (int i = 0; i < 4; ++i) {
-      auto index = used_segments_->GetSegment();
-      segments[i] = pmemptr_ + vlog_segment_size_ * index;
-      std::lock_guard<SpinMutex> status_lk(segment_statuses_[index].mutex);
-      segment_statuses_[index].status = kSegmentGC;
+    if (num_claimed_jobs == 0) {
+      WaitForWork(std::chrono::milliseconds(100));
+      continue;
     }
 
-    ReadAndSortData(segments);
+    gc_thread_pool_->SetJobCount(static_cast<int>(num_claimed_jobs));
+    for (size_t i = 0; i < num_claimed_jobs; ++i) {
+      gc_thread_pool_->SubmitJob(
+          std::bind(&VLogManager::CollectSegments, this, gc_jobs_[i]));
+    }
+    gc_thread_pool_->Join();
 
-    size_t index = 0;
-    size_t level;
-    uint64_t new_vptr;
-    bool stored_in_nvm;
+    // Collected segments are recycled by compactor
+    WakeupCompactor();
+  }
+}
 
-    auto data_count = gc_data.size();
+static GCTemperature ChooseTemperature(InnerNode* inner_node) {
+  auto heat_group = inner_node->heat_group_;
+  if (unlikely(!heat_group)) {
+    return kGCWarm;
+  }
 
-    KVStruct tmp_struct{};
+  int level = ChooseGroupLevelByHeat(heat_group);
+  return level < GC_WARM_LEVEL ? kGCCold
+                               : (level < GC_HOT_LEVEL ? kGCWarm : kGCHot);
+}
 
-    while (index < data_count) {
-      auto& cur_data = gc_data[index];
-      auto inner_node = mem_->FindInnerNodeByKey(
-          cur_data.key, level, stored_in_nvm);
+// Vptr of non-leaf node, or of one of its older versions kept for
+// snapshots, which points to actual_vptr.
+static uint64_t* FindNodeVptr(InnerNode* inner_node, uint64_t actual_vptr) {
+  if (ActualVptrSame(actual_vptr, inner_node->vptr_)) {
+    return &inner_node->vptr_;
+  }
+  for (auto version = inner_node->old_versions_; version;
+       version = version->next) {
+    if (ActualVptrSame(actual_vptr, version->vptr)) {
+      return &version->vptr;
+    }
+  }
+  return nullptr;
+}
 
-      // If inner node is not found, this record will be compacted later,
-      // so we just pass it.
-      if (unlikely(!inner_node)) {
-        ++index;
-        continue;
-      }
+void VLogManager::CollectSegments(GCJob* job) {
+  ReadAndSortData(job);
 
-      if (!stored_in_nvm) {
-        std::lock_guard<RWSpinLock> vptr_lk(inner_node->vptr_lock_);
+  auto& gc_data = job->gc_data;
+  size_t index = 0;
+  size_t level;
+  uint64_t new_vptr;
+  bool stored_in_nvm;
 
-        // If inner node is leaf node after holding vptr_lock,
-        // this record has been stored into node buffer.
-        if (unlikely(IS_LEAF(inner_node))) {
-          continue;
-        }
+  auto data_count = gc_data.size();
+
+  KVStruct tmp_struct{};
+
+  while (index < data_count) {
+    auto& cur_data = gc_data[index];
+    auto inner_node = mem_->FindInnerNodeByKey(
+        cur_data.key, level, stored_in_nvm);
 
-        Slice vptr_key = cur_data.key;
-        /*uint64_t new_hash = HashAndPrefix(
-            cur_data.key.data(), cur_data.key.size(), cur_data.key.size());*/
-        while (index < data_count &&
-               gc_data[index].key.compare(vptr_key) == 0) {
-          cur_data = gc_data[index++];
-          if (ActualVptrSame(cur_data.actual_vptr, inner_node->vptr_)) {
-            WriteToNewSegment(cur_data.record, new_vptr);
-            UpdateVptrInfo(inner_node->vptr_, new_vptr);
-            inner_node->vptr_ = new_vptr;
-            // inner_node->hash_ = new_hash;
+    // If inner node is not found, this record will be compacted later,
+    // so we just pass it.
+    if (unlikely(!inner_node)) {
+      ++index;
+      continue;
+    }
+
+    if (!stored_in_nvm) {
+      std::lock_guard<RWSpinLock> vptr_lk(inner_node->vptr_lock_);
+
+      // If inner node is leaf node after holding vptr_lock,
+      // this record has been stored into node buffer.
+      if (unlikely(IS_LEAF(inner_node))) {
+        continue;
+      }
+
+      Slice vptr_key = cur_data.key;
+      auto temperature = ChooseTemperature(inner_node);
+      auto& dest_segment = job->dest_segments[temperature];
+      while (index < data_count &&
+             gc_data[index].key.compare(vptr_key) == 0) {
+        auto& check_data = gc_data[index++];
+        auto vptr = FindNodeVptr(inner_node, check_data.actual_vptr);
+        if (vptr) {
+          Slice record = MaybeCompress(job, temperature, check_data);
+          WriteToSegment(dest_segment, record, new_vptr);
+          UpdateVptrInfo(*vptr, new_vptr);
+          *vptr = new_vptr;
+          if (vptr == &inner_node->vptr_) {
+            PersistNodeVptr(inner_node, new_vptr);
           }
         }
-        continue;
       }
+      continue;
+    }
 
-      {
-        std::lock_guard<SharedMutex> write_lk(inner_node->share_mutex_);
+    {
+      std::lock_guard<SharedMutex> write_lk(inner_node->share_mutex_);
 
-        // node is split or compacted
-        if (unlikely(NOT_LEAF(inner_node))) {
-          continue;
-        }
+      // node is split or compacted
+      if (unlikely(NOT_LEAF(inner_node))) {
+        continue;
+      }
 
-        Slice cur_prefix = Slice(cur_data.key.data(), level);
-        auto nvm_node = inner_node->nvm_node_;
-        int rows = GET_ROWS(nvm_node->meta.header);
+      Slice cur_prefix = Slice(cur_data.key.data(), level);
+      auto nvm_node = inner_node->nvm_node_;
+      int rows = GET_ROWS(nvm_node->meta.header);
+      auto temperature = ChooseTemperature(inner_node);
+      auto& dest_segment = job->dest_segments[temperature];
 
-        while (index < data_count) {
-          auto check_data = &gc_data[index];
-          if (!check_data->key.starts_with(cur_prefix)) {
-            break;
-          }
+      while (index < data_count) {
+        auto check_data = &gc_data[index];
+        if (!check_data->key.starts_with(cur_prefix)) {
+          break;
+        }
 
-          auto hash = Hash(check_data->key.data(), check_data->key.size(), 397);
-          auto found_index = SearchVptr(
-              inner_node, hash, rows,
-              check_data->key, check_data->actual_vptr, this);
-          if (found_index != -1) {
-            WriteToNewSegment(check_data->record, new_vptr);
-            tmp_struct.vptr = check_data->actual_vptr;
-            tmp_struct.actual_vptr = new_vptr;
-            new_vptr = tmp_struct.vptr;
-
-            if (found_index >= 0) {
-              nvm_node->data[found_index * 2 + 1] = new_vptr;
-            } else {
-              inner_node->buffer_[(-found_index - 2) * 2 + 1] = new_vptr;
-            }
+        auto hash = Hash(check_data->key.data(), check_data->key.size(), 397);
+        auto found_index = SearchVptr(
+            inner_node, hash, rows,
+            check_data->key, check_data->actual_vptr, this);
+        if (found_index != -1) {
+          Slice record = MaybeCompress(job, temperature, *check_data);
+          WriteToSegment(dest_segment, record, new_vptr);
+          tmp_struct.vptr = check_data->actual_vptr;
+          tmp_struct.actual_vptr = new_vptr;
+          new_vptr = tmp_struct.vptr;
+
+          if (found_index >= 0) {
+            nvm_node->data[found_index * 2 + 1] = new_vptr;
+          } else {
+            inner_node->buffer_[(-found_index - 2) * 2 + 1] = new_vptr;
           }
-          ++index;
-          pmem_persist(inner_node->nvm_node_, 4096);
         }
+        ++index;
+        PERSIST(inner_node->nvm_node_, 4096);
       }
     }
+  }
 
-    gc_freed_ += segments.size();
-    for (auto segment : segments) {
-      auto* header_gc = (VLogSegmentHeader*)segment;
-      header_gc->offset_ = vlog_header_size_;
-      header_gc->total_count_ = 0;
-      memset(header_gc->bitmap_, -1, vlog_bitmap_size_);
-      PERSIST(header_gc, vlog_header_size_);
-      used_segments_->ClearGarbage((segment - pmemptr_) / vlog_segment_size_);
-      gc_pages_.emplace_back((char*)header_gc);
-    }
+  gc_freed_ += job->segments.size();
+  for (auto segment : job->segments) {
+    auto* header_gc = (VLogSegmentHeader*)segment;
+    header_gc->offset_ = vlog_header_size_;
+    header_gc->total_count_ = 0;
+    memset(header_gc->bitmap_, -1, vlog_bitmap_size_);
+    PERSIST(header_gc, vlog_header_size_);
+    AdviseMemory(segment, vlog_segment_size_, MADV_RANDOM);
+    used_segments_->ClearGarbage((segment - pmemptr_) / vlog_segment_size_);
+    gc_pages_.emplace_back((char*)header_gc);
   }
 }
 
-void VLogManager::WriteToNewSegment(Slice& record, uint64_t& new_vptr) {
-  static RWSpinLock rw_spinLock;
+Slice VLogManager::MaybeCompress(GCJob* job, GCTemperature temperature,
+                                 const GCData& data) {
+  auto& record = data.record;
+  if (compression_type_ == kNoCompression || temperature != kGCCold ||
+      data.corrupted || ((ValueType*)record.data())[0] != kTypeValue) {
+    return record;
+  }
 
-  std::lock_guard<RWSpinLock> write_lk(rw_spinLock);
+  Slice slice(record.data() + RecordPrefixSize,
+              record.size() - RecordPrefixSize);
+  Slice key, value;
+  GetLengthPrefixedSlice(&slice, &key);
+  GetLengthPrefixedSlice(&slice, &value);
+  if (value.size() < VLOG_COMPRESSION_MIN_SIZE) {
+    return record;
+  }
+
+  // Value is kept as it is unless compression saves at least 1/8 of it.
+  std::string compressed;
+  CompressionInfo info(CompressionOptions(), *job->compression_ctx,
+                       CompressionDict::GetEmptyDict(), compression_type_, 0);
+  if (!CompressData(value, info, 2 /* format version */, &compressed) ||
+      compressed.size() + 1 >= value.size() - value.size() / 8) {
+    return record;
+  }
+
+  auto& output = job->compressed_record;
+  output.assign(record.data(), RecordPrefixSize);
+  output[0] = static_cast<char>(kTypeVLogCompressedValue);
+  PutLengthPrefixedSlice(&output, key);
+  PutVarint32(&output, static_cast<uint32_t>(compressed.size() + 1));
+  output.push_back(static_cast<char>(compression_type_));
+  output.append(compressed);
+
+  auto checksum = RecordChecksum(output.data(), output.size());
+  memcpy(&output[kRecordChecksumOffset], &checksum, sizeof(checksum));
+  return Slice(output);
+}
+
+void VLogManager::WriteToSegment(char*& segment, Slice& record,
+                                 uint64_t& new_vptr) {
+  if (unlikely(!segment)) {
+    segment = GetSegmentFromFreeQueue();
+    ++gc_used_;
+  }
 
   uint32_t left = record.size();
-  auto header = (VLogSegmentHeader*)segment_for_gc_;
+  auto header = (VLogSegmentHeader*)segment;
   auto offset = header->offset_;
   auto count = header->total_count_;
   size_t remain = vlog_segment_size_ - offset;
   if (remain < left) {
-    PushToUsedQueue(segment_for_gc_);
-    segment_for_gc_ = GetSegmentFromFreeQueue();
+    PushToUsedQueue(segment);
+    segment = GetSegmentFromFreeQueue();
     ++gc_used_;
 
-    header = (VLogSegmentHeader*)segment_for_gc_;
+    header = (VLogSegmentHeader*)segment;
     offset = header->offset_;
     count = header->total_count_;
     assert(header->total_count_ == 0);
@@ -522,16 +926,21 @@ void VLogManager::WriteToNewSegment(Slice& record, uint64_t& new_vptr) {
   }
 
   assert(offset < vlog_segment_size_);
-  MEMCPY(segment_for_gc_ + offset, record.data(), left,
+  MEMCPY(segment + offset, record.data(), left,
          PMEM_F_MEM_NODRAIN | PMEM_F_MEM_NONTEMPORAL);
-  *(RecordIndex*)(segment_for_gc_ + offset + 9) = count;
+  *(RecordIndex*)(segment + offset + kRecordIndexOffset) = count;
 
-  new_vptr = (segment_for_gc_ - pmemptr_) + offset;
+  new_vptr = (segment - pmemptr_) + offset;
   ++header->total_count_;
   header->offset_ += left;
   PERSIST(header, CACHE_LINE_SIZE);
 }
 
+void VLogManager::WriteToNewSegment(Slice& record, uint64_t& new_vptr) {
+  std::lock_guard<RWSpinLock> write_lk(segment_for_gc_lock_);
+  WriteToSegment(segment_for_gc_, record, new_vptr);
+}
+
 void VLogManager::UpdateBitmap(
     std::unordered_map<uint64_t, std::vector<RecordIndex>>& all_indexes) {
   for (auto& pair : all_indexes) {
@@ -549,11 +958,15 @@ void VLogManager::UpdateBitmap(
         pmemptr_ + vlog_segment_size_ * segment_id);
     auto bitmap = header->bitmap_;
 
+    // Only records turning from live to garbage are counted
+    int garbage_count = 0;
     for (auto& index : indexes) {
       assert(index / 8 < vlog_bitmap_size_);
-      bitmap[index / 8] &= ~(1 << (index % 8));
+      uint8_t bit = 1 << (index % 8);
+      garbage_count += (bitmap[index / 8] & bit) != 0;
+      bitmap[index / 8] &= ~bit;
     }
-    used_segments_->AddGarbage(segment_id, indexes.size());
+    used_segments_->AddGarbage(segment_id, garbage_count);
     PERSIST(header, vlog_header_size_);
   }
 
@@ -576,23 +989,26 @@ void VLogManager::UpdateBitmap(std::vector<std::vector<RecordIndex>>& all_indexe
     }
 
     RecordIndex max_index = indexes.front();
+    int garbage_count = 0;
     auto bitmap = header->bitmap_;
     for (auto& index : indexes) {
       assert(index / 8 < vlog_bitmap_size_);
-      bitmap[index / 8] &= ~(1 << (index % 8));
+      uint8_t bit = 1 << (index % 8);
+      garbage_count += (bitmap[index / 8] & bit) != 0;
+      bitmap[index / 8] &= ~bit;
       max_index = std::max(max_index, index);
     }
     indexes.clear();
 
-    used_segments_->AddGarbage(i, indexes.size());
+    used_segments_->AddGarbage(static_cast<int>(i), garbage_count);
     FLUSH(header, ALIGN_UP(max_index / 8, 256));
   }
 
   NVM_BARRIER;
 }
 
-void VLogManager::FreeQueue() {
-  size_t size = gc_pages_.size();
+void VLogManager::FreeQueue(size_t count) {
+  size_t size = std::min(count, gc_pages_.size());
   while (size--) {
     auto segment = gc_pages_.pop_front();
     auto index = GetIndex(segment);
@@ -600,11 +1016,16 @@ void VLogManager::FreeQueue() {
     segment_statuses_[index].status = kSegmentFree;
     free_segments_.emplace_back(segment);
   }
+
+  // Gc may be waiting for enough free segments
+  if (count && free_segments_.size() <= force_gc_ratio_) {
+    Wakeup();
+  }
 }
 
 void VLogManager::MaybeRewrite(KVStruct& kv_info) {
   uint64_t actual_vptr = kv_info.actual_vptr;
-  auto index = actual_vptr >> 20;
+  auto index = GetSegmentId(actual_vptr);
   auto header = GetHeader(index);
 
   segment_statuses_[index].mutex.lock();
@@ -613,7 +1034,8 @@ void VLogManager::MaybeRewrite(KVStruct& kv_info) {
 
   if (unlikely(status == kSegmentGC)) {
     char* record_start = pmemptr_ + actual_vptr;
-    Slice record(record_start, kv_info.kv_size);
+    // Record may be smaller than kv_size if its value is compressed
+    Slice record(record_start, GetRecordSize(actual_vptr));
     WriteToNewSegment(record, actual_vptr);
     kv_info.actual_vptr = actual_vptr;
   }
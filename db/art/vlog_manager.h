@@ -3,7 +3,9 @@
 //
 
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <rocksdb/rocksdb_namespace.h>
 #include <rocksdb/slice.h>
 #include <db/dbformat.h>
@@ -20,18 +22,50 @@ enum SegmentStatus : uint8_t {
   kSegmentGC,       // Segment is doing gc
 };
 
+// Value of record may be compressed when it is relocated by gc, such record
+// has this type, and its value starts with the compression type.
+const ValueType kTypeVLogCompressedValue =
+    static_cast<ValueType>(kTypeValue | 0x80);
+
+// Values smaller than this are not worth compressing.
+#define VLOG_COMPRESSION_MIN_SIZE 64
+
+// Bitmap in segment header has a bit for every record, segments smaller
+// than this can't map all records of minimal size (18 bytes).
+#define VLOG_MIN_SEGMENT_SIZE (256LL << 10)
+// Offsets in segment are 32-bit, segment must be smaller than this.
+#define VLOG_MAX_SEGMENT_SIZE (1LL << 32)
+
 struct StatusLock {
   SpinMutex     mutex;
   SegmentStatus status;
 };
 
+// Append position of a segment. Offset and count of records are packed
+// into one word, offset << 32 | count, so a writer reserves space and
+// record indexes together with a single fetch_add.
+struct AppendCursor {
+  std::atomic<uint64_t> reserved{0};
+  // Ranges below published have been copied into segment,
+  // writers publish their ranges in the order of reservation.
+  std::atomic<uint64_t> published{0};
+  // Position stored in segment header, guarded by persist_mutex
+  uint64_t              persisted = 0;
+  SpinMutex             persist_mutex;
+};
+
+// Range of a segment reserved for a write batch by ReserveRecord.
+struct VLogReservation {
+  size_t   segment_id = 0;
+  // Position of cursor before reservation, offset << 32 | count
+  uint64_t start = 0;
+};
+
 struct VLogSegmentHeader {
   struct alignas(CACHE_LINE_SIZE) {
-    // TODO: remove status from nvm to dram
-    SegmentStatus status_to_remove : 8;
-    uint32_t offset_: 24;
-    uint16_t total_count_ = 0;
-    uint16_t compacted_count_ = 0;
+    uint32_t offset_;
+    uint32_t total_count_ = 0;
+    uint32_t compacted_count_ = 0;
   };
   char    padding[64];
   uint8_t bitmap_[];
@@ -41,14 +75,48 @@ struct alignas(CACHE_LINE_SIZE) GCData {
   Slice    record;
   Slice    key;
   uint64_t actual_vptr;
+  // Record doesn't match its checksum, it is relocated as it is.
+  bool     corrupted;
 
   GCData() = default;
 
   GCData(const char* pmemptr, const char* record_start, int record_len,
-         const char* key_start, int key_len)
+         const char* key_start, int key_len, bool corrupted_)
       : record(Slice(record_start, record_len)),
         key(Slice(key_start, key_len)),
-        actual_vptr(record_start - pmemptr) {};
+        actual_vptr(record_start - pmemptr),
+        corrupted(corrupted_) {};
+};
+
+// Number of victim segments collected by a gc job at a time.
+#define GC_BATCH_SEGMENTS 4
+
+// Relocated records are separated by heat level of their heat groups,
+// records of groups below GC_WARM_LEVEL are cold, and those at or above
+// GC_HOT_LEVEL are hot.
+#define GC_WARM_LEVEL 1
+#define GC_HOT_LEVEL  3
+
+enum GCTemperature : uint8_t {
+  kGCCold,
+  kGCWarm,
+  kGCHot,
+  kNumGCTemperatures,
+};
+
+class CompressionContext;
+class ThreadPool;
+
+// A gc worker relocates live records of its victim segments into its own
+// destination segments, one for each temperature, so workers never
+// contend on destinations, and cold records stay apart from hot ones.
+struct GCJob {
+  std::vector<char*>  segments;
+  std::vector<GCData> gc_data;
+  char*               stored_keys;
+  char*               dest_segments[kNumGCTemperatures];
+  CompressionContext* compression_ctx;
+  std::string         compressed_record;
 };
 
 class GlobalMemtable;
@@ -69,29 +137,76 @@ class VLogManager : public BackgroundThread {
 
   void SetMemtable(GlobalMemtable* mem);
 
-  RecordIndex GetFirstIndex(size_t wal_size) const;
+  // Reserve space and record indexes of a batch in current segment,
+  // thread safe, indexes are assigned by order of reservation. Callers
+  // that serialize writes reserve under their lock and commit after
+  // releasing it, so batches are copied in parallel. Every reservation
+  // must be committed, ranges after it are published only after it.
+  VLogReservation ReserveRecord(size_t size, uint32_t record_count);
 
-  uint64_t AddRecord(const Slice& slice, uint32_t record_count);
+  // Copy batch into its reserved range and publish it, return vptr of
+  // the batch.
+  uint64_t CommitRecord(const VLogReservation& reservation,
+                        const Slice& slice, uint32_t record_count);
 
   void GetKey(uint64_t vptr, Slice& key);
 
   void GetKeyIndex(uint64_t vptr, std::string& key, RecordIndex& index);
 
-  ValueType GetKeyValue(uint64_t offset, std::string& key, std::string& value);
+  SequenceNumber GetSeqNum(uint64_t vptr);
 
-  ValueType GetKeyValue(uint64_t offset, std::string& key, std::string& value,
-                        SequenceNumber& seq_num);
+  // Exact size of record, used for records whose kv_size is rounded.
+  size_t GetRecordSize(uint64_t vptr);
 
-  ValueType GetKeyValue(uint64_t offset,
-                        std::string& key, Slice& value,
-                        SequenceNumber& seq_num, RecordIndex& index);
+  // Records of a write batch are stored in one segment, so a batch can't
+  // be larger than this.
+  size_t GetMaxBatchSize() const {
+    return vlog_segment_size_ - vlog_header_size_;
+  }
+
+  // Same as above, before vlog manager is created.
+  static size_t GetMaxBatchSize(int64_t vlog_segment_size) {
+    return vlog_segment_size - vlog_segment_size / 128;
+  }
+
+  // Id of segment which actual vptr points into.
+  size_t GetSegmentId(uint64_t actual_vptr) const {
+    return actual_vptr >> vlog_segment_shift_;
+  }
+
+  // Check record is well formed and matches its checksum.
+  Status VerifyRecord(uint64_t vptr);
+
+  // Return true if key of record equals to key, value points to vlog
+  // and is only set for kTypeValue and kTypeVLogCompressedValue.
+  bool MatchKey(uint64_t vptr, const Slice& key,
+                ValueType& type, Slice& value);
+
+  // Uncompress value of record of kTypeVLogCompressedValue.
+  Status UncompressValue(const Slice& value, std::string* uncompressed);
+
+  // Return Corruption if compressed value can't be uncompressed.
+  Status GetKeyValue(uint64_t offset, std::string& key, std::string& value,
+                     ValueType& type);
+
+  Status GetKeyValue(uint64_t offset, std::string& key, std::string& value,
+                     SequenceNumber& seq_num, ValueType& type);
+
+  // Key points to vlog, compressed value is uncompressed into a new string
+  // appended to uncompressed_values, and value points to it.
+  Status GetKeyValue(uint64_t offset,
+                     Slice& key, Slice& value,
+                     SequenceNumber& seq_num, RecordIndex& index,
+                     std::deque<std::string>* uncompressed_values,
+                     ValueType& type);
 
   void UpdateBitmap(
       std::unordered_map<uint64_t, std::vector<RecordIndex>>& all_indexes);
 
   void UpdateBitmap(std::vector<std::vector<RecordIndex>>& all_indexes);
 
-  void FreeQueue();
+  // Recycle the oldest count segments reclaimed by gc
+  void FreeQueue(size_t count);
 
   void MaybeRewrite(KVStruct& kv_info);
 
@@ -106,9 +221,32 @@ class VLogManager : public BackgroundThread {
 
   void PopFreeSegment();
 
+  // Wait until ranges reserved before start are published, then publish
+  // range [start, end) of segment.
+  void PublishRange(AppendCursor& cursor, uint64_t start, uint64_t end);
+
+  // Store published position into header of segment, writers published
+  // at the same time share a single persist.
+  void PersistCursor(size_t segment_id, uint64_t end);
+
+  void InitGCSegments();
+
+  void CollectSegments(GCJob* job);
+
+  // Append record to segment, segment is replaced by a free one when full,
+  // or taken from free queue if it is nullptr.
+  void WriteToSegment(char*& segment, Slice& record, uint64_t& new_vptr);
+
+  // Shared by compaction threads rewriting records in segments under gc.
   void WriteToNewSegment(Slice& record, uint64_t& new_vptr);
 
-  void ReadAndSortData(std::vector<char*>& segments);
+  void ReadAndSortData(GCJob* job);
+
+  // Return record to be relocated, value of cold record is compressed
+  // into compressed_record of job if it is worth it. Corrupted records
+  // are never compressed, which would give them a valid checksum.
+  Slice MaybeCompress(GCJob* job, GCTemperature temperature,
+                      const GCData& data);
 
   VLogSegmentHeader* GetHeader(size_t index) {
     return (VLogSegmentHeader*)(pmemptr_ + vlog_segment_size_ * index);
@@ -120,11 +258,14 @@ class VLogManager : public BackgroundThread {
 
   char* pmemptr_;
 
-  char* cur_segment_;
+  std::atomic<size_t> cur_segment_id_;
 
-  VLogSegmentHeader* header_;
+  // Writers reserving beyond end of current segment wait on this until
+  // the segment is sealed and cur_segment_id_ changes.
+  std::mutex segment_mutex_;
+  std::condition_variable segment_cv_;
 
-  uint32_t segment_remain_;
+  AppendCursor* cursors_;
 
   GlobalMemtable* mem_;
 
@@ -134,21 +275,29 @@ class VLogManager : public BackgroundThread {
   // because compaction thread may still need these segments.
   TQueueConcurrent<char*> gc_pages_;
 
-  std::vector<GCData> gc_data;
-
   char* segment_for_gc_;
 
+  RWSpinLock segment_for_gc_lock_;
+
+  std::vector<GCJob*> gc_jobs_;
+
+  ThreadPool* gc_thread_pool_;
+
   // Parameters
   const uint64_t vlog_file_size_;
   const uint64_t vlog_segment_size_;
+  const int      vlog_segment_shift_;
   const size_t   vlog_segment_num_;
   const uint64_t vlog_header_size_;
   const uint64_t vlog_bitmap_size_;
   const size_t   force_gc_ratio_;
+  const int      num_recovery_threads_;
+  const int      num_gc_threads_;
+  const CompressionType compression_type_;
 
   std::atomic<int> gc_freed_{0};
   std::atomic<int> gc_used_{0};
-  char*          stored_segment_keys_;
+  std::atomic<int> gc_corrupted_{0};
   StatusLock*    segment_statuses_;
 };
 
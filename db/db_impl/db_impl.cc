@@ -286,7 +286,11 @@ DBImpl::DBImpl(const DBOptions& options, const std::string& dbname,
   std::unordered_map<std::string, int64_t> memory_usages;
   memory_usages["vlog"] = options.vlog_file_size;
   memory_usages["nodememory"] = options.node_memory_size;
-  bool recovery = InitializeMemory(memory_usages, options.nvm_path);
+  bool recovery = false;
+  init_memory_status_ = InitializeMemory(memory_usages, options, &recovery);
+  if (!init_memory_status_.ok()) {
+    return;
+  }
 
   InitializeNodeAllocator(options, recovery);
   vlog_manager_ = new VLogManager(options, recovery);
@@ -297,7 +301,8 @@ DBImpl::DBImpl(const DBOptions& options, const std::string& dbname,
   group_manager_->StartThread();
 
   global_memtable_ = new GlobalMemtable(
-      vlog_manager_, group_manager_, env_, recovery);
+      vlog_manager_, group_manager_, env_, recovery,
+      options.num_recovery_threads);
 
   Compactor::compaction_threshold_ = options.compaction_threshold;
 
@@ -539,8 +544,10 @@ void DBImpl::CancelAllBackgroundWork(bool wait) {
 Status DBImpl::CloseHelper() {
   // Guarantee that there is no background error recovery in progress before
   // continuing with the shutdown
-  compactor_->StopThread();
-  group_manager_->StopThread();
+  if (compactor_ != nullptr) {
+    compactor_->StopThread();
+    group_manager_->StopThread();
+  }
   mutex_.Lock();
 
   shutdown_initiated_ = true;
@@ -1420,11 +1427,13 @@ InternalIterator* DBImpl::NewInternalIterator(const ReadOptions& read_options,
     cfd = cfh->cfd();
   }
 
+  auto art_epoch = PinIteratorEpoch();
   mutex_.Lock();
   SuperVersion* super_version = cfd->GetSuperVersion()->Ref();
   mutex_.Unlock();
   return NewInternalIterator(read_options, cfd, super_version, arena,
-                             range_del_agg, sequence, allow_unprepared_value);
+                             range_del_agg, sequence, allow_unprepared_value,
+                             art_epoch);
 }
 
 void DBImpl::SchedulePurge() {
@@ -1548,7 +1557,8 @@ InternalIterator* DBImpl::NewInternalIterator(const ReadOptions& read_options,
                                               Arena* arena,
                                               RangeDelAggregator* range_del_agg,
                                               SequenceNumber sequence,
-                                              bool allow_unprepared_value) {
+                                              bool allow_unprepared_value,
+                                              uint64_t art_epoch) {
   InternalIterator* internal_iter;
   assert(arena != nullptr);
   assert(range_del_agg != nullptr);
@@ -1558,9 +1568,9 @@ InternalIterator* DBImpl::NewInternalIterator(const ReadOptions& read_options,
       !read_options.total_order_seek &&
           super_version->mutable_cf_options.prefix_extractor != nullptr);
 
-  TryCreateIterator();
   // NVM iterator
-  merge_iter_builder.AddIterator(global_memtable_->NewIterator(read_options));
+  merge_iter_builder.AddIterator(
+      global_memtable_->NewIterator(read_options, sequence, art_epoch));
 
   std::unique_ptr<FragmentedRangeTombstoneIterator> range_del_iter;
   Status s;
@@ -1738,8 +1748,12 @@ Status DBImpl::GetImpl(const ReadOptions& read_options, const Slice& key,
 
   // Change
 #ifdef ART
-  std::string art_key(key.data(), key.size());
-  done = global_memtable_->Get(art_key, *get_impl_options.value->GetSelf(), &s);
+  // Filtering by sequence costs an extra vlog read per candidate, so it is
+  // only done for reads under an explicit snapshot.
+  done = global_memtable_->Get(
+      key, get_impl_options.value, &s,
+      read_options.snapshot != nullptr ? snapshot : kMaxSequenceNumber,
+      read_options.verify_checksums);
 #else
   if (!skip_memtable) {
     // Get value associated with key
@@ -1937,10 +1951,21 @@ std::vector<Status> DBImpl::MultiGet(
     assert(mgd_iter != multiget_cf_data.end());
     auto mgd = mgd_iter->second;
     auto super_version = mgd.super_version;
-    bool skip_memtable =
+    [[maybe_unused]] bool skip_memtable =
         (read_options.read_tier == kPersistedTier &&
          has_unpersisted_data_.load(std::memory_order_relaxed));
     bool done = false;
+#ifdef ART
+    PinnableSlice art_pinned_val(value);
+    done = global_memtable_->Get(
+        keys[keys_read], &art_pinned_val, &s,
+        read_options.snapshot != nullptr ? consistent_seqnum
+                                         : kMaxSequenceNumber,
+        read_options.verify_checksums);
+    if (art_pinned_val.IsPinned()) {
+      value->assign(art_pinned_val.data(), art_pinned_val.size());
+    }
+#else
     if (!skip_memtable) {
       if (super_version->mem->Get(lkey, value, timestamp, &s, &merge_context,
                                   &max_covering_tombstone_seq, read_options,
@@ -1955,6 +1980,7 @@ std::vector<Status> DBImpl::MultiGet(
         RecordTick(stats_, MEMTABLE_HIT);
       }
     }
+#endif
     if (!done) {
       PinnableSlice pinnable_val;
       PERF_TIMER_GUARD(get_from_output_files_time);
@@ -2462,9 +2488,19 @@ Status DBImpl::MultiGetImpl(
       *mget_iter->s = Status::OK();
     }
 
-    bool skip_memtable =
+    [[maybe_unused]] bool skip_memtable =
         (read_options.read_tier == kPersistedTier &&
          has_unpersisted_data_.load(std::memory_order_relaxed));
+#ifdef ART
+    global_memtable_->MultiGet(
+        read_options, &range,
+        read_options.snapshot != nullptr ? snapshot : kMaxSequenceNumber);
+    if (!range.empty()) {
+      lookup_current = true;
+      uint64_t left = range.KeysLeft();
+      RecordTick(stats_, MEMTABLE_MISS, left);
+    }
+#else
     if (!skip_memtable) {
       super_version->mem->MultiGet(read_options, &range, callback,
                                    is_blob_index);
@@ -2478,6 +2514,7 @@ Status DBImpl::MultiGetImpl(
         RecordTick(stats_, MEMTABLE_MISS, left);
       }
     }
+#endif
     if (lookup_current) {
       PERF_TIMER_GUARD(get_from_output_files_time);
       super_version->current->MultiGet(read_options, &range, callback,
@@ -2863,6 +2900,9 @@ ArenaWrappedDBIter* DBImpl::NewIteratorImpl(const ReadOptions& read_options,
                                             ReadCallback* read_callback,
                                             bool allow_blob,
                                             bool allow_refresh) {
+  // Pin before referencing super version, nvm nodes compacted into ssts
+  // it doesn't contain are kept for the iterator.
+  auto art_epoch = PinIteratorEpoch();
   SuperVersion* sv = cfd->GetReferencedSuperVersion(this);
 
   TEST_SYNC_POINT("DBImpl::NewIterator:1");
@@ -2934,7 +2974,7 @@ ArenaWrappedDBIter* DBImpl::NewIteratorImpl(const ReadOptions& read_options,
   InternalIterator* internal_iter = NewInternalIterator(
       db_iter->GetReadOptions(), cfd, sv, db_iter->GetArena(),
       db_iter->GetRangeDelAggregator(), snapshot,
-      /* allow_unprepared_value */ true);
+      /* allow_unprepared_value */ true, art_epoch);
   db_iter->SetIterUnderDBIter(internal_iter);
 
   return db_iter;
@@ -3020,6 +3060,9 @@ SnapshotImpl* DBImpl::GetSnapshotImpl(bool is_write_conflict_boundary,
                           : versions_->LastPublishedSequence();
   SnapshotImpl* snapshot =
       snapshots_.New(s, snapshot_seq, unix_time, is_write_conflict_boundary);
+#ifdef ART
+  SetLiveSnapshots(snapshots_.GetAll());
+#endif
   if (lock) {
     mutex_.Unlock();
   }
@@ -3043,6 +3086,9 @@ void DBImpl::ReleaseSnapshot(const Snapshot* s) {
   {
     InstrumentedMutexLock l(&mutex_);
     snapshots_.Delete(casted_s);
+#ifdef ART
+    SetLiveSnapshots(snapshots_.GetAll());
+#endif
     uint64_t oldest_snapshot;
     if (snapshots_.empty()) {
       if (last_seq_same_as_publish_seq_) {
@@ -84,6 +84,7 @@ class Version;
 class VersionEdit;
 class VersionSet;
 class WriteCallback;
+struct ArtInstallRequest;
 struct JobContext;
 struct ExternalSstFileInfo;
 struct MemTableInfo;
@@ -770,13 +771,16 @@ class DBImpl : public DB {
   const WriteController& write_controller() { return write_controller_; }
 
   // @param read_options Must outlive the returned iterator.
+  // @param art_epoch Iterator epoch pinned before super_version was
+  // referenced, the returned iterator releases it. 0 pins current epoch.
   InternalIterator* NewInternalIterator(const ReadOptions& read_options,
                                         ColumnFamilyData* cfd,
                                         SuperVersion* super_version,
                                         Arena* arena,
                                         RangeDelAggregator* range_del_agg,
                                         SequenceNumber sequence,
-                                        bool allow_unprepared_value);
+                                        bool allow_unprepared_value,
+                                        uint64_t art_epoch = 0);
 
   // hollow transactions shell used for recovery.
   // these will then be passed to TransactionDB so that
@@ -1248,6 +1252,10 @@ class DBImpl : public DB {
   // to ensure that db_session_id_ gets updated every time the DB is opened
   void SetDbSessionId();
 
+  // Status of mapping nvm in constructor, returned by DB::Open, ART
+  // components are left null if it fails.
+  Status init_memory_status_;
+
  private:
   friend class DB;
   friend class ErrorHandler;
@@ -1610,6 +1618,19 @@ class DBImpl : public DB {
                                 uint64_t* log_used,
                                 SequenceNumber* last_sequence, size_t seq_inc);
 
+  // Insert records of all writers in write_group into global memtable
+  // with one batched insert.
+  void InsertIntoGlobalMemtable(WriteThread::WriteGroup& write_group);
+
+  // Reserve space of merged batch in vlog, see VLogManager::ReserveRecord.
+  VLogReservation ReserveVLog(const WriteBatch& merged_batch);
+
+  // Copy merged batch into its reserved space, and set vptrs of batches of
+  // write group from their positions in merged batch.
+  void CommitVLog(const WriteThread::WriteGroup& write_group,
+                  const WriteBatch& merged_batch,
+                  const VLogReservation& reservation);
+
   // Used by WriteImpl to update bg_error_ if paranoid check is enabled.
   // Caller must hold mutex_.
   void WriteStatusCheckOnLocked(const Status& status);
@@ -1676,6 +1697,16 @@ class DBImpl : public DB {
                                 Env::Priority thread_pri);
   void BackgroundCallFlush(Env::Priority thread_pri);
   void SyncCallFlush(std::vector<SingleCompactionJob*>& jobs);
+  // Build sst of a single compaction job and install it, called by
+  // compaction threads concurrently, see InstallArtFlushResults.
+  void PipelinedCallFlush(SingleCompactionJob* job);
+  // Results of jobs finished while a batch is being installed are queued,
+  // and installed by the installing thread in next batch with one
+  // manifest write. Return after result of request is installed.
+  void InstallArtFlushResults(ArtInstallRequest* request,
+                              ColumnFamilyData* cfd,
+                              SuperVersionContext* sv_context,
+                              const MutableCFOptions& mutable_cf_options);
   void BackgroundCallPurge();
   Status BackgroundCompaction(bool* madeProgress, JobContext* job_context,
                               LogBuffer* log_buffer,
@@ -1887,18 +1918,15 @@ class DBImpl : public DB {
 
   std::atomic<bool> shutting_down_;
 
-  VLogManager* vlog_manager_;
-
-  GlobalMemtable* global_memtable_;
+  VLogManager* vlog_manager_ = nullptr;
 
-  Compactor* compactor_;
+  GlobalMemtable* global_memtable_ = nullptr;
 
-  TimerCompaction* compact_timer_;
+  Compactor* compactor_ = nullptr;
 
-  HeatGroupManager* group_manager_;
+  TimerCompaction* compact_timer_ = nullptr;
 
-  // Offset of last record written by leader writer.
-  uint64_t last_record_offset_;
+  HeatGroupManager* group_manager_ = nullptr;
 
   // If zero, manual compactions are allowed to proceed. If non-zero, manual
   // compactions may still be running, but will quickly fail with
@@ -2223,6 +2251,10 @@ class DBImpl : public DB {
   // installed to MANIFEST first.
   InstrumentedCondVar atomic_flush_install_cv_;
 
+  // Guarded by mutex_, waiters are signalled through bg_cv_.
+  std::deque<ArtInstallRequest*> art_install_queue_;
+  bool art_install_in_progress_ = false;
+
   bool wal_in_db_path_;
 };
 
@@ -2555,13 +2555,14 @@ void DBImpl::SyncCallFlush(std::vector<SingleCompactionJob*>& jobs) {
     }
 
     mutex_.Unlock();
-    SingleCompactionJob::thread_pool->SetJobCount(db_jobs.size());
+    auto thread_pool = compactor_->GetThreadPool();
+    thread_pool->SetJobCount(db_jobs.size());
     for (auto& db_job : db_jobs) {
       auto func = std::bind(&NVMFlushJob::Build,
                             db_job.nvm_flush_job);
-      SingleCompactionJob::thread_pool->SubmitJob(func);
+      thread_pool->SubmitJob(func);
     }
-    SingleCompactionJob::thread_pool->Join();
+    thread_pool->Join();
 
     mutex_.Lock();
     InternalStats::CompactionStats stats(CompactionReason::kFlush, 1);
@@ -2630,6 +2631,131 @@ void DBImpl::SyncCallFlush(std::vector<SingleCompactionJob*>& jobs) {
   }
 }
 
+struct ArtInstallRequest {
+  NVMFlushJob* nvm_flush_job;
+  bool         done;
+};
+
+void DBImpl::PipelinedCallFlush(SingleCompactionJob* job) {
+  JobContext job_context(next_job_id_.fetch_add(1), true);
+
+  TEST_SYNC_POINT("DBImpl::PipelinedCallFlush:start");
+
+  LogBuffer log_buffer(InfoLogLevel::DEBUG_LEVEL,
+                       immutable_db_options_.info_log.get());
+  {
+    InstrumentedMutexLock l(&mutex_);
+
+    std::unique_ptr<std::list<uint64_t>::iterator>
+        pending_outputs_inserted_elem(new std::list<uint64_t>::iterator(
+            CaptureCurrentFileNumberInPendingOutputs()));
+
+    // Only default column family is created and used.
+    auto cfd_set = versions_->GetColumnFamilySet();
+    assert(cfd_set->NumberOfColumnFamilies() == 1);
+    ColumnFamilyData* default_cfd = *cfd_set->begin();
+    MutableCFOptions mutable_cf_options =
+        *default_cfd->GetLatestMutableCFOptions();
+
+    num_running_flushes_++;
+    NVMFlushJob nvm_flush_job(
+        job,
+        dbname_, default_cfd, immutable_db_options_, mutable_cf_options,
+        file_options_for_compaction_, versions_.get(),
+        &mutex_, &shutting_down_,
+        &job_context, &log_buffer, directories_.GetDbDir(),
+        GetDataDir(default_cfd, 0U),
+        GetCompressionFlush(*default_cfd->ioptions(), mutable_cf_options), stats_,
+        &event_logger_, mutable_cf_options.report_bg_io_stats,
+        true /* sync_output_directory */, true /* write_manifest */,
+        io_tracer_, db_id_, db_session_id_);
+    nvm_flush_job.logs_with_prep_tracker_ = &logs_with_prep_tracker_;
+    nvm_flush_job.Preprocess();
+
+    mutex_.Unlock();
+    nvm_flush_job.Build();
+    mutex_.Lock();
+
+    ArtInstallRequest request{&nvm_flush_job, false};
+    InstallArtFlushResults(&request, default_cfd,
+                           &job_context.superversion_contexts[0],
+                           mutable_cf_options);
+
+    auto sfm = static_cast<SstFileManagerImpl*>(
+        immutable_db_options_.sst_file_manager.get());
+    if (sfm) {
+      // Notify sst_file_manager that a new file was added
+      std::string file_path = MakeTableFileName(
+          default_cfd->ioptions()->cf_paths[0].path,
+          nvm_flush_job.meta_.fd.GetNumber());
+      sfm->OnAddFile(file_path);
+    }
+
+    TEST_SYNC_POINT("DBImpl::PipelinedCallFlush:FlushFinish:0");
+    ReleaseFileNumberFromPendingOutputs(pending_outputs_inserted_elem);
+
+    FindObsoleteFiles(&job_context, false);
+    // delete unnecessary files if any, this is done outside the mutex
+    if (job_context.HaveSomethingToClean() ||
+        job_context.HaveSomethingToDelete() || !log_buffer.IsEmpty()) {
+      mutex_.Unlock();
+      log_buffer.FlushBufferToLog();
+      if (job_context.HaveSomethingToDelete()) {
+        PurgeObsoleteFiles(job_context);
+      }
+      job_context.Clean();
+      mutex_.Lock();
+    }
+
+    num_running_flushes_--;
+    bg_cv_.SignalAll();
+  }
+}
+
+void DBImpl::InstallArtFlushResults(
+    ArtInstallRequest* request, ColumnFamilyData* cfd,
+    SuperVersionContext* sv_context,
+    const MutableCFOptions& mutable_cf_options) {
+  mutex_.AssertHeld();
+
+  art_install_queue_.push_back(request);
+  while (!request->done && art_install_in_progress_) {
+    bg_cv_.Wait();
+  }
+  if (request->done) {
+    return;
+  }
+
+  // Install results of all queued jobs, including those queued while
+  // manifest of previous batch is being written.
+  art_install_in_progress_ = true;
+  while (!art_install_queue_.empty()) {
+    std::vector<ArtInstallRequest*> batch(art_install_queue_.begin(),
+                                          art_install_queue_.end());
+    art_install_queue_.clear();
+
+    cfd->mem()->SetNextLogNumber(logfile_number_);
+    InternalStats::CompactionStats stats(CompactionReason::kFlush, 1);
+    for (auto batched : batch) {
+      batched->nvm_flush_job->PostProcess(stats);
+    }
+    batch.back()->nvm_flush_job->WriteResult(stats);
+
+    InstallSuperVersionAndScheduleWork(cfd, sv_context, mutable_cf_options);
+
+    for (auto batched : batch) {
+      batched->done = true;
+    }
+    bg_cv_.SignalAll();
+  }
+  art_install_in_progress_ = false;
+
+  VersionStorageInfo::LevelSummaryStorage tmp;
+  ROCKS_LOG_INFO(immutable_db_options_.info_log, "[%s] Level summary: %s\n",
+                 cfd->GetName().c_str(),
+                 cfd->current()->storage_info()->LevelSummary(&tmp));
+}
+
 void DBImpl::BackgroundCallCompaction(PrepickedCompaction* prepicked_compaction,
                                       Env::Priority bg_thread_pri) {
   bool made_progress = false;
@@ -12,6 +12,7 @@
 #include "db/db_impl/db_impl.h"
 #include "db/error_handler.h"
 #include "db/periodic_work_scheduler.h"
+#include "db/write_batch_internal.h"
 #include "env/composite_env_wrapper.h"
 #include "file/read_write_util.h"
 #include "file/sst_file_manager_impl.h"
@@ -98,6 +99,15 @@ DBOptions SanitizeOptions(const std::string& dbname, const DBOptions& src) {
     result.recycle_log_file_num = false;
   }
 
+#ifdef ART
+  // A write group is appended to vlog as one merged batch, which must fit
+  // in a segment. Merged batch keeps one header out of those of the group.
+  result.max_write_batch_group_size_bytes = std::min<uint64_t>(
+      result.max_write_batch_group_size_bytes,
+      VLogManager::GetMaxBatchSize(result.vlog_segment_size) +
+          WriteBatchInternal::kHeader);
+#endif
+
   if (result.recycle_log_file_num &&
       (result.wal_recovery_mode ==
            WALRecoveryMode::kTolerateCorruptedTailRecords ||
@@ -269,6 +279,27 @@ Status DBImpl::ValidateOptions(const DBOptions& db_options) {
         "atomic_flush is currently incompatible with best-efforts recovery");
   }
 
+#ifdef ART
+  // Segment id and offset are packed into the 40 bits of a vptr.
+  if (db_options.vlog_segment_size <= 0 ||
+      (db_options.vlog_segment_size & (db_options.vlog_segment_size - 1))) {
+    return Status::InvalidArgument(
+        "vlog_segment_size must be a power of two");
+  }
+
+  if (db_options.vlog_segment_size < VLOG_MIN_SEGMENT_SIZE ||
+      db_options.vlog_segment_size >= VLOG_MAX_SEGMENT_SIZE) {
+    return Status::InvalidArgument(
+        "vlog_segment_size must be at least 256K and less than 4G");
+  }
+
+  if (db_options.vlog_file_size < db_options.vlog_segment_size ||
+      db_options.vlog_file_size > (int64_t)(1ULL << 40)) {
+    return Status::InvalidArgument(
+        "vlog_file_size must be between vlog_segment_size and 1T");
+  }
+#endif
+
   return Status::OK();
 }
 
@@ -1532,7 +1563,10 @@ Status DBImpl::Open(const DBOptions& db_options, const std::string& dbname,
   }
 
   DBImpl* impl = new DBImpl(db_options, dbname, seq_per_batch, batch_per_txn);
-  s = impl->env_->CreateDirIfMissing(impl->immutable_db_options_.wal_dir);
+  s = impl->init_memory_status_;
+  if (s.ok()) {
+    s = impl->env_->CreateDirIfMissing(impl->immutable_db_options_.wal_dir);
+  }
   if (s.ok()) {
     std::vector<std::string> paths;
     for (auto& db_path : impl->immutable_db_options_.db_paths) {
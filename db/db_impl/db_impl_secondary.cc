@@ -626,7 +626,10 @@ Status DB::OpenAsSecondary(
   impl->wal_in_db_path_ = IsWalDirSameAsDBPath(&impl->immutable_db_options_);
 
   impl->mutex_.Lock();
-  s = impl->Recover(column_families, true, false, false);
+  s = impl->init_memory_status_;
+  if (s.ok()) {
+    s = impl->Recover(column_families, true, false, false);
+  }
   if (s.ok()) {
     for (auto cf : column_families) {
       auto cfd =
@@ -61,6 +61,16 @@ Status DBImpl::WriteWithCallback(const WriteOptions& write_options,
 }
 #endif  // ROCKSDB_LITE
 
+void DBImpl::InsertIntoGlobalMemtable(WriteThread::WriteGroup& write_group) {
+  std::vector<ArtPutBatch> batches;
+  batches.reserve(write_group.size);
+  for (auto writer : write_group) {
+    batches.push_back({WriteBatchInternal::Contents(writer->batch),
+                       writer->batch->GetVptr(), writer->batch->Count()});
+  }
+  global_memtable_->MultiPut(batches.data(), batches.size());
+}
+
 // The main write queue. This is the only write queue that updates LastSequence.
 // When using one write queue, the same sequence also indicates the last
 // published sequence.
@@ -88,6 +98,12 @@ Status DBImpl::WriteImpl(const WriteOptions& write_options,
   if (write_options.sync && write_options.disableWAL) {
     return Status::InvalidArgument("Sync writes has to enable WAL.");
   }
+#ifdef ART
+  if (WriteBatchInternal::ByteSize(my_batch) - WriteBatchInternal::kHeader >
+      vlog_manager_->GetMaxBatchSize()) {
+    return Status::InvalidArgument("Write batch exceeds vlog segment size.");
+  }
+#endif
   if (two_write_queues_ && immutable_db_options_.enable_pipelined_write) {
     return Status::NotSupported(
         "pipelined_writes is not compatible with concurrent prepares");
@@ -347,14 +363,6 @@ Status DBImpl::WriteImpl(const WriteOptions& write_options,
       SequenceNumber next_sequence = current_sequence;
       size_t index = 0;
 
-      // Precalculate wal size to determine RecordIndex for each record.
-      size_t wal_size = 0;
-      for (auto* writer : write_group) {
-        wal_size +=
-            (writer->batch->GetDataSize() - WriteBatchInternal::kHeader);
-      }
-      RecordIndex next_index = vlog_manager_->GetFirstIndex(wal_size);
-
       // Note: the logic for advancing seq here must be consistent with the
       // logic in WriteBatchInternal::InsertInto(write_group...) as well as
       // with WriteBatchInternal::InsertInto(write_batch...) that is called on
@@ -377,9 +385,7 @@ Status DBImpl::WriteImpl(const WriteOptions& write_options,
         auto batch_count = WriteBatchInternal::Count(writer->batch);
         for (size_t i = 0; i < batch_count; ++i) {
           writer->batch->SetSequenceNumber(next_sequence + i, i);
-          writer->batch->SetRecordIndex(next_index + i, i);
         }
-        next_index += batch_count;
 
         if (seq_per_batch_) {
           assert(writer->batch_cnt);
@@ -416,11 +422,7 @@ Status DBImpl::WriteImpl(const WriteOptions& write_options,
       if (!parallel) {
         // w.sequence will be set inside InsertInto
 #ifdef ART
-        for (auto writer : write_group) {
-          Slice input = WriteBatchInternal::Contents(writer->batch);
-          global_memtable_->Put(
-              input, writer->batch->GetVptr(), writer->batch->Count());
-        }
+        InsertIntoGlobalMemtable(write_group);
 #else
         w.status = WriteBatchInternal::InsertInto(
             write_group, current_sequence, column_family_memtables_.get(),
@@ -543,14 +545,6 @@ Status DBImpl::PipelinedWriteImpl(const WriteOptions& write_options,
     size_t total_count = 0;
     size_t total_byte_size = 0;
 
-    // Precalculate wal size to determine RecordIndex for each record.
-    size_t wal_size = 0;
-    for (auto* writer : wal_write_group) {
-      wal_size +=
-          (writer->batch->GetDataSize() - WriteBatchInternal::kHeader);
-    }
-    RecordIndex next_index = vlog_manager_->GetFirstIndex(wal_size);
-
     if (w.status.ok()) {
       SequenceNumber next_sequence = current_sequence;
       for (auto writer : wal_write_group) {
@@ -561,9 +555,7 @@ Status DBImpl::PipelinedWriteImpl(const WriteOptions& write_options,
 
             for (size_t i = 0; i < count; ++i) {
               writer->batch->SetSequenceNumber(next_sequence + i, i);
-              writer->batch->SetRecordIndex(next_index + i, i);
             }
-            next_index += count;
             next_sequence += count;
             total_count += count;
           }
@@ -628,11 +620,7 @@ Status DBImpl::PipelinedWriteImpl(const WriteOptions& write_options,
       write_thread_.LaunchParallelMemTableWriters(& memtable_write_group);
     } else {
 #ifdef ART
-      for (auto writer : memtable_write_group) {
-        Slice input = WriteBatchInternal::Contents(writer->batch);
-        global_memtable_->Put(
-            input, writer->batch->GetVptr(), writer->batch->Count());
-      }
+      InsertIntoGlobalMemtable(memtable_write_group);
 #else
       memtable_write_group.status = WriteBatchInternal::InsertInto(
           memtable_write_group, w.sequence, column_family_memtables_.get(),
@@ -1109,9 +1097,7 @@ IOStatus DBImpl::WriteToWAL(const WriteBatch& merged_batch,
   }
 
 #ifdef ART
-  log_entry.remove_prefix(WriteBatchInternal::kHeader);
-  last_record_offset_ = vlog_manager_->AddRecord(
-      log_entry, WriteBatchInternal::Count(&merged_batch));
+  // Batches are appended to vlog by ReserveVLog and CommitVLog instead.
   IOStatus io_s;
 #else
   IOStatus io_s = log_writer->AddRecord(log_entry);
@@ -1135,6 +1121,29 @@ IOStatus DBImpl::WriteToWAL(const WriteBatch& merged_batch,
   return io_s;
 }
 
+VLogReservation DBImpl::ReserveVLog(const WriteBatch& merged_batch) {
+  Slice contents = WriteBatchInternal::Contents(&merged_batch);
+  return vlog_manager_->ReserveRecord(
+      contents.size() - WriteBatchInternal::kHeader,
+      WriteBatchInternal::Count(&merged_batch));
+}
+
+void DBImpl::CommitVLog(const WriteThread::WriteGroup& write_group,
+                        const WriteBatch& merged_batch,
+                        const VLogReservation& reservation) {
+  Slice contents = WriteBatchInternal::Contents(&merged_batch);
+  contents.remove_prefix(WriteBatchInternal::kHeader);
+  uint64_t vptr = vlog_manager_->CommitRecord(
+      reservation, contents, WriteBatchInternal::Count(&merged_batch));
+  if (&merged_batch == write_group.leader->batch) {
+    // Written as it is, MergeBatch didn't set its position.
+    merged_batch.SetRelativePos(0);
+  }
+  for (auto writer : write_group) {
+    writer->batch->SetBaseOffset(vptr);
+  }
+}
+
 IOStatus DBImpl::WriteToWAL(const WriteThread::WriteGroup& write_group,
                             log::Writer* log_writer, uint64_t* log_used,
                             bool need_log_sync, bool need_log_dir_sync,
@@ -1164,9 +1173,9 @@ IOStatus DBImpl::WriteToWAL(const WriteThread::WriteGroup& write_group,
   }
 
 #ifdef ART
-  for (auto writer : write_group) {
-    writer->batch->SetBaseOffset(last_record_offset_);
-  }
+  // Write thread lets one leader in at a time, nothing to release before
+  // copying.
+  CommitVLog(write_group, *merged_batch, ReserveVLog(*merged_batch));
 #endif
 
   if (io_s.ok() && need_log_sync) {
@@ -1244,7 +1253,15 @@ IOStatus DBImpl::ConcurrentWriteToWAL(
     cached_recoverable_state_ = *to_be_cached_state;
     cached_recoverable_state_empty_ = false;
   }
+#ifdef ART
+  // Reserve in order of sequence, and copy after unlock in parallel with
+  // the other write queue.
+  VLogReservation reservation = ReserveVLog(*merged_batch);
+#endif
   log_write_mutex_.Unlock();
+#ifdef ART
+  CommitVLog(write_group, *merged_batch, reservation);
+#endif
 
   if (io_s.ok()) {
     const bool concurrent = true;
@@ -615,6 +615,38 @@ TEST_F(DBOptionsTest, SanitizeDelayedWriteRate) {
   ASSERT_EQ(31 * 1024 * 1024, dbfull()->GetDBOptions().delayed_write_rate);
 }
 
+#ifdef ART
+TEST_F(DBOptionsTest, ValidateVLogSize) {
+  Options options = CurrentOptions();
+  options.nvm_path = dbname_ + "_nvm";
+  options.vlog_segment_size = 3 << 20;
+  ASSERT_TRUE(TryReopen(options).IsInvalidArgument());
+
+  options.vlog_segment_size = 0;
+  ASSERT_TRUE(TryReopen(options).IsInvalidArgument());
+
+  // Bitmap of segment header underflows.
+  options.vlog_segment_size = 8 << 10;
+  ASSERT_TRUE(TryReopen(options).IsInvalidArgument());
+
+  // Bitmap can't cover all records.
+  options.vlog_segment_size = 128 << 10;
+  ASSERT_TRUE(TryReopen(options).IsInvalidArgument());
+
+  // Offsets in segment are 32-bit.
+  options.vlog_segment_size = 1LL << 32;
+  options.vlog_file_size = 1LL << 33;
+  ASSERT_TRUE(TryReopen(options).IsInvalidArgument());
+
+  options.vlog_segment_size = 1 << 20;
+  options.vlog_file_size = 1 << 19;
+  ASSERT_TRUE(TryReopen(options).IsInvalidArgument());
+
+  options.vlog_file_size = (1LL << 40) + (1 << 20);
+  ASSERT_TRUE(TryReopen(options).IsInvalidArgument());
+}
+#endif
+
 TEST_F(DBOptionsTest, SanitizeUniversalTTLCompaction) {
   Options options;
   options.compaction_style = kCompactionStyleUniversal;
@@ -441,6 +441,42 @@ TEST_P(DBWriteTest, ConcurrentlyDisabledWAL) {
     ASSERT_LE(bytes_num, 1024 * 100);
 }
 
+#ifdef ART
+// A write group is appended to vlog as one merged batch, so it can't grow
+// beyond what a vlog segment holds however many writers join it.
+TEST_P(DBWriteTest, WriteGroupFitsVLogSegment) {
+  Options options = GetOptions();
+  options.nvm_path = dbname_ + "_nvm";
+  options.vlog_file_size = 64 << 20;
+  options.node_memory_size = 64 << 20;
+  Reopen(options);
+  const size_t max_batch_size =
+      VLogManager::GetMaxBatchSize(options.vlog_segment_size);
+  ASSERT_LE(dbfull()->GetDBOptions().max_write_batch_group_size_bytes,
+            max_batch_size + WriteBatchInternal::kHeader);
+
+  // Each batch is a bit larger than a third of segment, so any three of
+  // them overflow it when merged.
+  std::string value(max_batch_size / 3, 'v');
+  const int kNumThreads = 8;
+  const int kNumWrites = 16;
+  std::vector<port::Thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kNumWrites; i++) {
+        ASSERT_OK(Put(Key(t * kNumWrites + i), value));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  for (int i = 0; i < kNumThreads * kNumWrites; i++) {
+    ASSERT_EQ(value, Get(Key(i)));
+  }
+}
+#endif
+
 INSTANTIATE_TEST_CASE_P(DBWriteTestInstance, DBWriteTest,
                         testing::Values(DBTestBase::kDefault,
                                         DBTestBase::kConcurrentWALWrites,
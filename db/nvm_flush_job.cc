@@ -115,13 +115,6 @@ void NVMFlushJob::RecordFlushIOStats() {
 }
 
 void NVMFlushJob::Preprocess() {
-  edit_ = cfd_->mem()->GetEdits();
-  edit_->SetPrevLogNumber(0);
-  // SetLogNumber(log_num) indicates logs with number smaller than log_num
-  // will no longer be picked up for recovery.
-  edit_->SetLogNumber(cfd_->mem()->GetNextLogNumber());
-  edit_->SetColumnFamily(cfd_->GetID());
-
   // path 0 for level 0 file.
   meta_.fd = FileDescriptor(versions_->NewFileNumber(), 0, 0);
 
@@ -220,15 +213,32 @@ void NVMFlushJob::Build() {
 void NVMFlushJob::PostProcess(InternalStats::CompactionStats& stats) {
   base_->Unref();
 
+  // Edit is shared by all flush jobs, it is only touched when results are
+  // installed, so jobs can be built while another batch is being installed.
+  edit_ = cfd_->mem()->GetEdits();
+  edit_->SetPrevLogNumber(0);
+  // SetLogNumber(log_num) indicates logs with number smaller than log_num
+  // will no longer be picked up for recovery.
+  edit_->SetLogNumber(cfd_->mem()->GetNextLogNumber());
+  edit_->SetColumnFamily(cfd_->GetID());
+
   const bool has_output = meta_.fd.GetFileSize() > 0;
   if (has_output) {
     // if we have more than 1 background thread, then we cannot
     // insert files directly into higher levels because some other
     // threads could be concurrently producing compacted files for
     // that key range.
-    // Add file to L0
+    // Add file to the lowest level it fits in, see PickOutputLevel
 #ifndef EXPERIMENT
-    edit_->AddFile(0 /* level */, meta_.fd.GetNumber(), meta_.fd.GetPathId(),
+    int level = PickOutputLevel();
+    if (level > 0) {
+      ROCKS_LOG_BUFFER(log_buffer_,
+                       "[%s] [JOB %d] Level-0 flush table #%" PRIu64
+                       ": placed at level %d",
+                       cfd_->GetName().c_str(), job_context_->job_id,
+                       meta_.fd.GetNumber(), level);
+    }
+    edit_->AddFile(level, meta_.fd.GetNumber(), meta_.fd.GetPathId(),
                    meta_.fd.GetFileSize(), meta_.smallest, meta_.largest,
                    meta_.fd.smallest_seqno, meta_.fd.largest_seqno,
                    meta_.marked_for_compaction, meta_.oldest_blob_file_number,
@@ -245,6 +255,52 @@ void NVMFlushJob::PostProcess(InternalStats::CompactionStats& stats) {
   }
 }
 
+// Files in levels above 0 may overlap each other when they are tiered,
+// so every file is checked instead of searching for range.
+static bool OverlapWithFiles(const Comparator* ucmp,
+                             const std::vector<FileMetaData*>& files,
+                             const Slice& smallest, const Slice& largest) {
+  for (auto f : files) {
+    if (ucmp->Compare(f->smallest.user_key(), largest) <= 0 &&
+        ucmp->Compare(f->largest.user_key(), smallest) >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int NVMFlushJob::PickOutputLevel() {
+  auto ucmp = cfd_->user_comparator();
+  Slice smallest = meta_.smallest.user_key();
+  Slice largest = meta_.largest.user_key();
+
+  // Outputs of other jobs installed together
+  for (auto& new_file : edit_->GetNewFiles()) {
+    if (ucmp->Compare(new_file.second.smallest.user_key(), largest) <= 0 &&
+        ucmp->Compare(new_file.second.largest.user_key(), smallest) >= 0) {
+      return 0;
+    }
+  }
+
+  // Data in output is newer than all data in sst files, so it can sink
+  // through levels holding no key in its range, like an ingested file.
+  auto vstorage = cfd_->current()->storage_info();
+  int target_level = 0;
+  for (int level = 0; level < vstorage->num_levels(); ++level) {
+    if (OverlapWithFiles(ucmp, vstorage->LevelFiles(level),
+                         smallest, largest)) {
+      break;
+    }
+    if (level > 0 &&
+        cfd_->RangeOverlapWithCompaction(smallest, largest, level)) {
+      // Output of a running compaction will be stored in this level
+      break;
+    }
+    target_level = level;
+  }
+  return target_level;
+}
+
 void NVMFlushJob::WriteResult(InternalStats::CompactionStats& stats) {
   cfd_->mem()->SetFlushJobInfo(GetFlushJobInfo());
   RecordTimeToHistogram(stats_, FLUSH_TIME, stats.micros);
@@ -98,6 +98,9 @@ class NVMFlushJob {
   void ReportStartedFlush();
   void RecordFlushIOStats();
   std::unique_ptr<FlushJobInfo> GetFlushJobInfo() const;
+  // Return the lowest level whose files, and files of all levels above it,
+  // don't overlap output. Requires db mutex.
+  int PickOutputLevel();
 
   const std::string& dbname_;
   const std::string db_id_;
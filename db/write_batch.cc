@@ -779,9 +779,11 @@ Status WriteBatchInternal::Put(WriteBatch* b, uint32_t column_family_id,
   // Reserve space for sequence number
   SequenceNumber dummy_number = 0;
   RecordIndex dummy_index = 0;
+  uint32_t dummy_checksum = 0;
   b->sequence_number_pos_.push_back(b->rep_.size());
   PutFixed64(&b->rep_, dummy_number);
   PutFixed32(&b->rep_, dummy_index);
+  PutFixed32(&b->rep_, dummy_checksum);
 
   if (0 == b->timestamp_size_) {
     PutLengthPrefixedSlice(&b->rep_, key);
@@ -927,9 +929,11 @@ Status WriteBatchInternal::Delete(WriteBatch* b, uint32_t column_family_id,
   // Reserve space for sequence number
   SequenceNumber dummy_number = 0;
   RecordIndex dummy_index = 0;
+  uint32_t dummy_checksum = 0;
   b->sequence_number_pos_.push_back(b->rep_.size());
   PutFixed64(&b->rep_, dummy_number);
   PutFixed32(&b->rep_, dummy_index);
+  PutFixed32(&b->rep_, dummy_checksum);
 
   if (0 == b->timestamp_size_) {
     PutLengthPrefixedSlice(&b->rep_, key);
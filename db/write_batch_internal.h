@@ -69,8 +69,10 @@ class WriteBatchInternal {
   // WriteBatch header has an 8-byte sequence number followed by a 4-byte count.
   static const size_t kHeader = 12;
 
+  // Each record starts with type, sequence number, record index and
+  // checksum of record, the last two are filled when stored into vlog.
   static const size_t kRecordPrefixSize =
-      1 + sizeof(SequenceNumber) + sizeof(RecordIndex);
+      1 + sizeof(SequenceNumber) + sizeof(RecordIndex) + sizeof(uint32_t);
 
   // WriteBatch methods with column_family_id instead of ColumnFamilyHandle*
   static Status Put(WriteBatch* batch, uint32_t column_family_id,
@@ -1175,6 +1175,16 @@ struct DBOptions {
   // Default: 4
   int num_parallel_compactions = 4;
 
+  // Number of threads running compaction jobs and building their sst
+  // files, 0 means num_parallel_compactions. Threads run at Env::HIGH.
+  // Default: 0
+  int num_compaction_threads = 0;
+
+  // NUMA node that compaction threads run on, -1 means no binding.
+  // Only works when built with NUMA.
+  // Default: -1
+  int compaction_numa_node = -1;
+
   // Amount of data in global memtable before trigger compaction.
   // Default: 5G
   int64_t compaction_threshold = 5120LL << 20;
@@ -1195,6 +1205,8 @@ struct DBOptions {
 
   // Vlog file is divided into several segments,
   // in order to do garbage collection.
+  // Must be a power of two in [256K, 4G), and vlog_file_size is at
+  // most 1T.
   // Default: 1M
   int64_t vlog_segment_size = 1ULL << 20;
 
@@ -1203,6 +1215,16 @@ struct DBOptions {
   // default: 0.4
   float vlog_force_gc_ratio_ = 0.4f;
 
+  // Maximum number of threads doing vlog garbage collection, more of them
+  // are used as free segments run lower.
+  // default: 4
+  int num_vlog_gc_threads = 4;
+
+  // Values of cold records relocated by vlog gc are compressed with this,
+  // each value is compressed on its own.
+  // default: kNoCompression
+  CompressionType vlog_compression = kNoCompression;
+
   // Why choose 1.021897 ?
   // Because 1.021897 ^ 32 = 2.
   // default: 1.021897
@@ -1221,10 +1243,44 @@ struct DBOptions {
   // default: 1G
   int64_t node_memory_size = 1024LL << 20;
 
+  // Number of threads rebuilding nvm nodes and scanning vlog segments
+  // on recovery.
+  // default: 8
+  int num_recovery_threads = 8;
+
   bool enable_rewrite = true;
 
   // Path for nvm file, don't pass directory.
   std::string nvm_path = "/mnt/chen/nodememory";
+
+  // Nvm file is mapped at an address aligned to this, so that a DAX
+  // file system can map it with 2M or 1G pages. If nvm file lives in dram
+  // (e.g. tmpfs), transparent huge pages are requested for it.
+  // default: 2M
+  int64_t nvm_page_size = 2 << 20;
+
+  // Fault in whole nvm file when it is mapped, instead of on first access.
+  // default: false
+  bool nvm_populate = false;
+
+  // NUMA node whose memory backs nvm file, -1 means no binding.
+  // Only works for nvm file in dram, and when built with NUMA.
+  // default: -1
+  int nvm_numa_node = -1;
+
+  // Options below only work when built without USE_PMEM, nvm is emulated
+  // with dram then.
+  // Latency paid by a fence after flushes, in nanoseconds.
+  // default: 0
+  int nvm_emu_write_latency_ns = 0;
+
+  // Latency of reading a vlog record, in nanoseconds.
+  // default: 0
+  int nvm_emu_read_latency_ns = 0;
+
+  // Write bandwidth shared by all threads in MB/s, 0 means unlimited.
+  // default: 0
+  int64_t nvm_emu_write_bandwidth_mb = 0;
 };
 
 // Options to control the behavior of a database (passed to DB::Open)
@@ -397,9 +397,9 @@ class WriteBatch : public WriteBatchBase {
   // It is used to calculate vptr.
   mutable int pos_in_merged_batch_ = 0;
 
-  // Offset of record inserted to vlog by leader writer,
+  // Vptr of merged batch holding this batch in vlog,
   // used to calculate vptr.
-  uint64_t base_record_offset_;
+  uint64_t base_record_offset_ = 0;
 
   // Store all reserved space for sequence numbers.
   std::vector<size_t> sequence_number_pos_;
@@ -38,6 +38,8 @@ LIB_SOURCES =                                                   \
   db/art/utils.cc                                               \
   db/art/vlog_manager.cc                                        \
   db/art/nvm_manager.cc                                         \
+  db/art/nvm_emulator.cc                                        \
+  db/art/simd_probe.cc                                          \
   db/db_impl/db_impl.cc                                         \
   db/db_impl/db_impl_compaction_flush.cc                        \
   db/db_impl/db_impl_debug.cc                                   \
@@ -365,6 +367,9 @@ BENCH_MAIN_SOURCES =                                                    \
 TEST_MAIN_SOURCES =                                                     \
   cache/cache_test.cc                                                   \
   cache/lru_cache_test.cc                                               \
+  db/art/concurrent_queue_test.cc                                       \
+  db/art/simd_probe_test.cc                                             \
+  db/art/utils_test.cc                                                  \
   db/blob/blob_file_addition_test.cc                                    \
   db/blob/blob_file_builder_test.cc                                     \
   db/blob/blob_file_garbage_test.cc                                     \